@@ -0,0 +1,334 @@
+/*
+ * Command line Icecream status monitor
+ * Copyright (C) 2018-2020 by Garmin Ltd. or its subsidiaries.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+// Times the model and the ncurses rendering at a few farm sizes, and writes
+// the results as JSON. The screen is rendered to /dev/null
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <glib.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "draw.hpp"
+#include "main.hpp"
+
+// Number of times each render is repeated
+#define RENDER_ITERATIONS (10)
+
+// Number of times the job lists of every host are walked
+#define WALK_ITERATIONS (10)
+
+// Number of utilization samples taken, enough to roll up into every level
+#define SAMPLE_ITERATIONS (60)
+
+// Width of the job graphs drawn by print_job_graph
+#define GRAPH_WIDTH (40)
+
+static gchar *opt_output = NULL;
+static gboolean opt_quick = FALSE;
+
+struct Scale {
+    size_t hosts;
+    size_t jobs;
+};
+
+static const Scale scales[] = {
+    {    10,     100 },
+    {  1000,   10000 },
+    { 10000, 1000000 },
+};
+
+struct Result {
+    std::string name;
+    Scale scale;
+    size_t iterations;
+    uint64_t total_ns;
+};
+
+class BenchmarkScheduler: public Scheduler {
+public:
+    virtual std::string getNetName() const override { return "BENCHMARK"; }
+    virtual std::string getSchedulerName() const override { return "benchmark"; }
+};
+
+class Timer {
+public:
+    Timer() : start(std::chrono::steady_clock::now()) {}
+
+    uint64_t elapsed() const
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count();
+    }
+
+private:
+    std::chrono::steady_clock::time_point start;
+};
+
+// Runs the main loop until the interface has drawn everything it was asked to
+static void render()
+{
+    while (g_main_context_iteration(nullptr, FALSE))
+        ;
+}
+
+static uint32_t client_id(Scale const &scale, size_t i)
+{
+    return i % scale.hosts + 1;
+}
+
+// Each job is compiled on the host after its client, so every host has both
+// incoming and outgoing jobs
+static uint32_t server_id(Scale const &scale, size_t i)
+{
+    return (i + 1) % scale.hosts + 1;
+}
+
+static void run_scale(Scale const &scale, int input_fd, std::vector<Result> &results)
+{
+    auto add_result = [&](char const *name, size_t iterations, uint64_t ns) {
+        results.push_back({ name, scale, iterations, ns });
+        std::cerr << "  " << name << ": " << (iterations ? ns / iterations : 0) << " ns/op" << std::endl;
+    };
+
+    std::cerr << scale.hosts << " hosts, " << scale.jobs << " jobs" << std::endl;
+
+    std::vector<std::string> files;
+    for (size_t i = 0; i < std::min<size_t>(scale.jobs, 1000); i++)
+        files.push_back("src/module" + std::to_string(i / 10) + "/file" + std::to_string(i) + ".c");
+
+    std::string max_jobs = std::to_string(std::max<size_t>(scale.jobs / scale.hosts, 1));
+
+    {
+        Timer t;
+        for (uint32_t id = 1; id <= scale.hosts; id++) {
+            auto h = Host::create(id);
+            h->attr["Name"] = "Host " + std::to_string(id);
+            h->attr["MaxJobs"] = max_jobs;
+            h->attr["NoRemote"] = "false";
+            h->attr["Platform"] = "x86_64";
+            h->attr["Speed"] = "100.000";
+            h->updateProfile();
+        }
+        add_result("host_create", scale.hosts, t.elapsed());
+    }
+    render();
+
+    {
+        Timer t;
+        for (size_t i = 0; i < scale.jobs; i++)
+            Job::createPending(i + 1, client_id(scale, i), files[i % files.size()]);
+        add_result("job_create_pending", scale.jobs, t.elapsed());
+    }
+
+    {
+        Timer t;
+        for (size_t i = 0; i < scale.jobs; i++)
+            Job::createRemote(i + 1, server_id(scale, i));
+        add_result("job_create_remote", scale.jobs, t.elapsed());
+    }
+    render();
+
+    {
+        size_t count = 0;
+        Timer t;
+        for (int n = 0; n < WALK_ITERATIONS; n++) {
+            for (auto const &h : Host::hosts) {
+                for (auto *j : h.second->getPendingJobs())
+                    count += j->id & 1;
+                for (auto *j : h.second->getActiveJobs())
+                    count += j->id & 1;
+                for (auto *j : h.second->getCurrentJobs())
+                    count += j->id & 1;
+            }
+        }
+        add_result("host_get_jobs", scale.hosts * WALK_ITERATIONS, t.elapsed());
+
+        // Keep the walk from being optimized away
+        if (count > scale.jobs * WALK_ITERATIONS * 3)
+            std::cerr << "Unexpected job count " << count << std::endl;
+    }
+
+    {
+        Timer t;
+        for (int n = 0; n < SAMPLE_ITERATIONS; n++)
+            Host::sampleUtilization();
+        add_result("sample_utilization", scale.hosts * SAMPLE_ITERATIONS, t.elapsed());
+    }
+
+    {
+        Timer t;
+        for (auto const &h : Host::hosts)
+            print_job_graph(*interface, h.second->getMaxJobs(), GRAPH_WIDTH, h.second->getJobGraph());
+        add_result("print_job_graph", scale.hosts, t.elapsed());
+    }
+
+    {
+        // Reversing the sort repaints the whole screen
+        Timer t;
+        for (int n = 0; n < RENDER_ITERATIONS; n++) {
+            if (write(input_fd, "r", 1) != 1)
+                std::cerr << "Unable to send key: " << strerror(errno) << std::endl;
+            interface->processInput();
+            render();
+        }
+        add_result("render_full", RENDER_ITERATIONS, t.elapsed());
+    }
+
+    {
+        // A few jobs finish and are replaced between each render
+        size_t changes = std::max<size_t>(scale.jobs / 100, 1);
+
+        Timer t;
+        for (int n = 0; n < RENDER_ITERATIONS; n++) {
+            for (size_t i = 0; i < changes; i++) {
+                size_t k = (n * changes + i) % scale.jobs;
+
+                Job::remove(k + 1);
+                Job::createPending(k + 1, client_id(scale, k), files[k % files.size()]);
+                Job::createRemote(k + 1, server_id(scale, k));
+            }
+            render();
+        }
+        add_result("render_incremental", RENDER_ITERATIONS, t.elapsed());
+    }
+
+    {
+        Timer t;
+        for (size_t i = 0; i < scale.jobs; i++)
+            Job::remove(i + 1);
+        add_result("job_remove", scale.jobs, t.elapsed());
+    }
+
+    Job::clearAll();
+    Host::clearAll();
+    model_changes.setReset();
+    render();
+}
+
+static void write_results(std::ostream &out, std::vector<Result> const &results)
+{
+    out << "{\"version\":\"" << VERSION << "\",\"benchmarks\":[";
+    for (size_t i = 0; i < results.size(); i++) {
+        auto const &r = results[i];
+
+        out << (i ? "," : "") << "\n  {\"name\":\"" << r.name <<
+            "\",\"hosts\":" << r.scale.hosts <<
+            ",\"jobs\":" << r.scale.jobs <<
+            ",\"iterations\":" << r.iterations <<
+            ",\"total_ns\":" << r.total_ns <<
+            ",\"ns_per_op\":" << (r.iterations ? r.total_ns / r.iterations : 0) << "}";
+    }
+    out << "\n]}" << std::endl;
+}
+
+static bool parse_args(int *argc, char ***argv)
+{
+    static const GOptionEntry opts[] =
+    {
+        { "output", 'o', 0, G_OPTION_ARG_FILENAME, &opt_output, "Write the results to FILE instead of stdout", "FILE" },
+        { "quick", 0, 0, G_OPTION_ARG_NONE, &opt_quick, "Skip the largest farm size", NULL },
+        {}
+    };
+
+    GOptionContext *context = g_option_context_new(nullptr);
+    g_option_context_add_main_entries(context, opts, NULL);
+
+    GError *error = NULL;
+    bool ok = g_option_context_parse(context, argc, argv, &error);
+    if (!ok) {
+        std::cout << "Option parsing failed: " << error->message << std::endl;
+        g_clear_error(&error);
+    }
+    g_option_context_free(context);
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    if (!parse_args(&argc, &argv))
+        return 1;
+
+    // The screen size is fixed, so runs are comparable
+    setenv("TERM", "xterm", 0);
+    setenv("LINES", "50", 0);
+    setenv("COLUMNS", "200", 0);
+
+    int input[2];
+    if (pipe(input) < 0) {
+        std::cerr << "Unable to create pipe: " << strerror(errno) << std::endl;
+        return 1;
+    }
+
+    FILE *out = fopen("/dev/null", "w");
+    FILE *in = fdopen(input[0], "r");
+    if (!out || !in) {
+        std::cerr << "Unable to open terminal: " << strerror(errno) << std::endl;
+        return 1;
+    }
+
+    main_loop = g_main_loop_new(nullptr, false);
+    scheduler = std::make_unique<BenchmarkScheduler>();
+    interface = create_ncurses_interface(out, in);
+    if (!interface) {
+        std::cerr << "Unable to create terminal of type " << getenv("TERM") << std::endl;
+        return 1;
+    }
+    interface->set_anonymize(false);
+    render();
+
+    std::vector<Result> results;
+    for (auto const &scale : scales) {
+        if (opt_quick && scale.jobs > 10000)
+            continue;
+        run_scale(scale, input[1], results);
+    }
+
+    interface.reset();
+    scheduler.reset();
+    g_main_loop_unref(main_loop);
+
+    fclose(in);
+    fclose(out);
+    close(input[1]);
+
+    if (opt_output) {
+        std::ofstream file(opt_output);
+        write_results(file, results);
+        if (!file) {
+            std::cerr << "Unable to write " << opt_output << std::endl;
+            return 1;
+        }
+    } else {
+        write_results(std::cout, results);
+    }
+
+    return 0;
+}
@@ -0,0 +1,729 @@
+/*
+ * Command line Icecream status monitor
+ * Copyright (C) 2018-2020 by Garmin Ltd. or its subsidiaries.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+template <typename T, typename Tag> class IntrusiveList;
+
+// Embedded links for an IntrusiveList. An object can be in several lists at
+// once by deriving from one hook per list, distinguished by Tag
+template <typename T, typename Tag = void>
+struct ListHook {
+    T *list_prev = nullptr;
+    T *list_next = nullptr;
+    IntrusiveList<T, Tag> *list_owner = nullptr;
+};
+
+// Doubly linked list that stores its links in the items themselves, so
+// insertion and removal never allocate and an item can be removed in O(1)
+// without knowing which list it is in.
+template <typename T, typename Tag = void>
+class IntrusiveList {
+public:
+    typedef ListHook<T, Tag> Hook;
+
+    class iterator {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef T *value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef T *const *pointer;
+        typedef T *reference;
+
+        explicit iterator(T *item) : m_item(item) {}
+
+        T *operator*() const { return m_item; }
+
+        iterator &operator++()
+        {
+            m_item = hook(m_item).list_next;
+            return *this;
+        }
+
+        bool operator==(iterator const &other) const { return m_item == other.m_item; }
+        bool operator!=(iterator const &other) const { return m_item != other.m_item; }
+
+    private:
+        T *m_item;
+    };
+
+    IntrusiveList() {}
+    IntrusiveList(IntrusiveList const &) = delete;
+    IntrusiveList &operator=(IntrusiveList const &) = delete;
+
+    ~IntrusiveList()
+    {
+        clear();
+    }
+
+    iterator begin() const { return iterator(m_head); }
+    iterator end() const { return iterator(nullptr); }
+
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    T *front() const { return m_head; }
+
+    bool contains(T const *item) const
+    {
+        return hook(item).list_owner == this;
+    }
+
+    // Appends the item, removing it from any other list of the same kind
+    // first
+    void push_back(T *item)
+    {
+        auto &h = hook(item);
+
+        if (h.list_owner)
+            h.list_owner->erase(item);
+
+        h.list_prev = m_tail;
+        h.list_next = nullptr;
+        h.list_owner = this;
+
+        if (m_tail)
+            hook(m_tail).list_next = item;
+        else
+            m_head = item;
+        m_tail = item;
+        m_size++;
+    }
+
+    void erase(T *item)
+    {
+        auto &h = hook(item);
+        assert(h.list_owner == this);
+
+        if (h.list_prev)
+            hook(h.list_prev).list_next = h.list_next;
+        else
+            m_head = h.list_next;
+
+        if (h.list_next)
+            hook(h.list_next).list_prev = h.list_prev;
+        else
+            m_tail = h.list_prev;
+
+        h.list_prev = nullptr;
+        h.list_next = nullptr;
+        h.list_owner = nullptr;
+        m_size--;
+    }
+
+    // Removes the item from whichever list of this kind it is in, if any
+    static void unlink(T *item)
+    {
+        auto &h = hook(item);
+        if (h.list_owner)
+            h.list_owner->erase(item);
+    }
+
+    void clear()
+    {
+        while (m_head)
+            erase(m_head);
+    }
+
+private:
+    static Hook &hook(T *item) { return static_cast<Hook&>(*item); }
+    static Hook const &hook(T const *item) { return static_cast<Hook const&>(*item); }
+
+    T *m_head = nullptr;
+    T *m_tail = nullptr;
+    size_t m_size = 0;
+};
+
+// Open addressing hash map from non-zero 32-bit ids to small values (e.g.
+// pointers). All entries live in one flat array, so lookups touch a single
+// cache line in the common case and nothing is allocated per entry.
+template <typename V>
+class FlatIdMap {
+public:
+    FlatIdMap()
+    {
+        rehash(MIN_CAPACITY);
+    }
+
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    // Number of slots, which is what clear() and forEach() take time for
+    size_t capacity() const { return m_slots.size(); }
+
+    V *find(uint32_t key)
+    {
+        size_t i = probe(key);
+        return m_slots[i].key ? &m_slots[i].value : nullptr;
+    }
+
+    V const *find(uint32_t key) const
+    {
+        return const_cast<FlatIdMap*>(this)->find(key);
+    }
+
+    // Inserts or replaces the value for key
+    void set(uint32_t key, V value)
+    {
+        assert(key != 0);
+
+        if ((m_size + 1) * 2 > m_slots.size())
+            rehash(m_slots.size() * 2);
+
+        size_t i = probe(key);
+        if (!m_slots[i].key) {
+            m_slots[i].key = key;
+            m_size++;
+        }
+        m_slots[i].value = value;
+    }
+
+    bool erase(uint32_t key)
+    {
+        size_t i = probe(key);
+        if (!m_slots[i].key)
+            return false;
+
+        // Backward shift deletion keeps probe chains intact without
+        // tombstones
+        size_t mask = m_slots.size() - 1;
+        size_t j = i;
+        for (;;) {
+            j = (j + 1) & mask;
+            if (!m_slots[j].key)
+                break;
+
+            size_t home = bucket(m_slots[j].key);
+            if (((j - home) & mask) >= ((j - i) & mask)) {
+                m_slots[i] = m_slots[j];
+                i = j;
+            }
+        }
+        m_slots[i].key = 0;
+        m_slots[i].value = V();
+        m_size--;
+        return true;
+    }
+
+    // Removes every entry. If the slots are far more than the entries that
+    // were in the map needed, the map shrinks back, so that clearing and
+    // iterating don't stay slow for good after one burst of entries
+    void clear()
+    {
+        size_t capacity = MIN_CAPACITY;
+        while (capacity < m_size * 4)
+            capacity *= 2;
+
+        if (capacity < m_slots.size()) {
+            m_slots.clear();
+            rehash(capacity);
+            return;
+        }
+
+        for (auto &s : m_slots)
+            s = Slot();
+        m_size = 0;
+    }
+
+    template <typename F>
+    void forEach(F f) const
+    {
+        if (!m_size)
+            return;
+
+        for (auto const &s : m_slots) {
+            if (s.key)
+                f(s.key, s.value);
+        }
+    }
+
+private:
+    static const size_t MIN_CAPACITY = 16;
+
+    struct Slot {
+        uint32_t key = 0;
+        V value = V();
+    };
+
+    // Fibonacci hashing; the high bits of the product are the well mixed
+    // ones
+    size_t bucket(uint32_t key) const
+    {
+        return static_cast<uint32_t>(key * UINT32_C(2654435761)) >> m_shift;
+    }
+
+    size_t probe(uint32_t key) const
+    {
+        size_t mask = m_slots.size() - 1;
+        size_t i = bucket(key);
+
+        while (m_slots[i].key && m_slots[i].key != key)
+            i = (i + 1) & mask;
+        return i;
+    }
+
+    void rehash(size_t capacity)
+    {
+        std::vector<Slot> old;
+        old.swap(m_slots);
+        m_slots.resize(capacity);
+        m_size = 0;
+
+        m_shift = 32;
+        while (capacity > 1) {
+            capacity >>= 1;
+            m_shift--;
+        }
+
+        for (auto const &s : old) {
+            if (s.key)
+                set(s.key, s.value);
+        }
+    }
+
+    std::vector<Slot> m_slots;
+    size_t m_size = 0;
+    unsigned m_shift = 32;
+};
+
+// Allocates objects out of fixed size chunks and recycles freed slots, so
+// that objects with a high turnover don't churn the heap and stay close
+// together in memory. Object addresses are stable for their lifetime.
+template <typename T, size_t ChunkSize = 256>
+class ObjectPool {
+public:
+    ObjectPool() {}
+    ObjectPool(ObjectPool const &) = delete;
+    ObjectPool &operator=(ObjectPool const &) = delete;
+
+    // Objects must be destroyed before the pool is
+    ~ObjectPool()
+    {
+        assert(m_live == 0);
+    }
+
+    template <typename... Args>
+    T *create(Args&&... args)
+    {
+        if (m_free.empty())
+            grow();
+
+        void *p = m_free.back();
+        m_free.pop_back();
+
+        T *obj = new (p) T(std::forward<Args>(args)...);
+        m_live++;
+        return obj;
+    }
+
+    void destroy(T *obj)
+    {
+        obj->~T();
+        m_free.push_back(obj);
+        m_live--;
+    }
+
+    size_t size() const { return m_live; }
+    size_t capacity() const { return m_chunks.size() * ChunkSize; }
+
+private:
+    typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type Storage;
+
+    void grow()
+    {
+        m_chunks.emplace_back(new Storage[ChunkSize]);
+        Storage *chunk = m_chunks.back().get();
+
+        // Hand out the lowest addresses first
+        m_free.reserve(m_free.size() + ChunkSize);
+        for (size_t i = ChunkSize; i > 0; i--)
+            m_free.push_back(&chunk[i - 1]);
+    }
+
+    std::vector<std::unique_ptr<Storage[]> > m_chunks;
+    std::vector<void*> m_free;
+    size_t m_live = 0;
+};
+
+// Fixed capacity FIFO that overwrites its oldest entry when full. Storage is
+// allocated once when the capacity is set, so pushing never allocates.
+template <typename T>
+class RingBuffer {
+public:
+    explicit RingBuffer(size_t capacity = 0)
+    {
+        setCapacity(capacity);
+    }
+
+    // Changes the capacity. Discards all entries
+    void setCapacity(size_t capacity)
+    {
+        m_items.assign(capacity, T());
+        m_head = 0;
+        m_size = 0;
+    }
+
+    size_t capacity() const { return m_items.size(); }
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    bool full() const { return m_size == m_items.size(); }
+
+    // Total number of items ever pushed, including overwritten ones
+    uint64_t total() const { return m_total; }
+
+    void push(T const &item)
+    {
+        if (m_items.empty())
+            return;
+
+        m_items[m_head] = item;
+        m_head = m_head + 1 == m_items.size() ? 0 : m_head + 1;
+        if (m_size < m_items.size())
+            m_size++;
+        m_total++;
+    }
+
+    // Index 0 is the oldest entry. i must be less than size()
+    T const &operator[](size_t i) const
+    {
+        assert(i < m_size);
+
+        size_t start = m_head + m_items.size() - m_size;
+        return m_items[(start + i) % m_items.size()];
+    }
+
+    // The newest entry. The buffer must not be empty
+    T const &back() const
+    {
+        assert(!empty());
+        return (*this)[m_size - 1];
+    }
+
+    void clear()
+    {
+        m_head = 0;
+        m_size = 0;
+    }
+
+private:
+    std::vector<T> m_items;
+    size_t m_head = 0;
+    size_t m_size = 0;
+    uint64_t m_total = 0;
+};
+
+// Unsigned integer samples kept at several resolutions. The first level holds the
+// samples as they are pushed, and each following level the averages of a
+// number of consecutive samples of the level before it, so older history is
+// kept at a coarser resolution. Every level is a ring buffer, so the memory
+// is fixed once the levels are set, and the averages are summed up as the
+// samples arrive, so a push costs O(1) for a fixed number of levels.
+struct RollupLevel {
+    // Number of samples of the previous level that are averaged into each
+    // sample of this one. Ignored for the first level
+    unsigned factor;
+    size_t capacity;
+};
+
+template <typename T>
+class RollupSeries {
+    static_assert(std::is_unsigned<T>::value, "Samples must be unsigned integers");
+
+public:
+    RollupSeries() = default;
+
+    explicit RollupSeries(std::vector<RollupLevel> const &levels)
+    {
+        setLevels(levels);
+    }
+
+    // Changes the levels. Discards all samples
+    void setLevels(std::vector<RollupLevel> const &levels)
+    {
+        m_levels.clear();
+        for (auto const &l : levels)
+            m_levels.push_back({ RingBuffer<T>(l.capacity), l.factor ? l.factor : 1, 0, 0 });
+    }
+
+    size_t levels() const { return m_levels.size(); }
+
+    // Samples of a level. Index 0 is the oldest
+    RingBuffer<T> const &getLevel(size_t level) const { return m_levels[level].samples; }
+
+    void push(T value)
+    {
+        for (size_t i = 0; i < m_levels.size(); i++) {
+            auto &l = m_levels[i];
+
+            if (i) {
+                l.sum += value;
+                if (++l.count < l.factor)
+                    return;
+
+                // Round to the nearest
+                value = static_cast<T>((l.sum + l.factor / 2) / l.factor);
+                l.sum = 0;
+                l.count = 0;
+            }
+
+            l.samples.push(value);
+        }
+    }
+
+    void clear()
+    {
+        for (auto &l : m_levels) {
+            l.samples.clear();
+            l.sum = 0;
+            l.count = 0;
+        }
+    }
+
+private:
+    struct State {
+        RingBuffer<T> samples;
+        unsigned factor;
+        // Samples of the previous level that aren't in this one yet
+        unsigned count;
+        uint64_t sum;
+    };
+
+    std::vector<State> m_levels;
+};
+
+// Counts of unsigned values in buckets whose width grows with the value, so
+// that percentiles are accurate to within 1/2^SubBits of the value in a
+// fixed amount of memory. Each power of two range is split into 2^SubBits
+// buckets, and values below 2^SubBits are counted exactly. Values of 2^MaxBits
+// or more are counted in the last bucket. Adding a value is O(1) and never
+// allocates.
+template <unsigned SubBits, unsigned MaxBits>
+class LogHistogram {
+    static_assert(SubBits < MaxBits && MaxBits < 64, "Invalid histogram range");
+
+public:
+    static const size_t SUB_BUCKETS = size_t(1) << SubBits;
+    static const size_t NUM_BUCKETS = (MaxBits - SubBits + 1) * SUB_BUCKETS;
+
+    LogHistogram()
+    {
+        clear();
+    }
+
+    uint64_t count() const { return m_count; }
+    bool empty() const { return m_count == 0; }
+
+    void add(uint64_t value)
+    {
+        m_buckets[bucket(value)]++;
+        m_count++;
+    }
+
+    // Returns the value below which the fraction p (0 to 1) of the values
+    // fall, as the middle of the bucket it is in. Returns 0 if the histogram
+    // is empty
+    uint64_t percentile(double p) const
+    {
+        if (!m_count)
+            return 0;
+
+        // Nearest rank
+        uint64_t rank = static_cast<uint64_t>(p * m_count + 0.999999);
+        rank = rank ? (rank < m_count ? rank : m_count) : 1;
+
+        uint64_t seen = 0;
+        for (size_t i = 0; i < NUM_BUCKETS; i++) {
+            seen += m_buckets[i];
+            if (seen >= rank)
+                return lower(i) + (width(i) - 1) / 2;
+        }
+        return lower(NUM_BUCKETS - 1);
+    }
+
+    void clear()
+    {
+        for (auto &b : m_buckets)
+            b = 0;
+        m_count = 0;
+    }
+
+private:
+    static size_t bucket(uint64_t value)
+    {
+        if (value < SUB_BUCKETS)
+            return value;
+        if (value >> MaxBits)
+            return NUM_BUCKETS - 1;
+
+        // The position of the highest bit picks the range, and the bits
+        // below it the bucket within the range
+        unsigned bits = 63 - __builtin_clzll(value);
+        size_t sub = (value >> (bits - SubBits)) & (SUB_BUCKETS - 1);
+        return (bits - SubBits + 1) * SUB_BUCKETS + sub;
+    }
+
+    static uint64_t lower(size_t i)
+    {
+        if (i < SUB_BUCKETS)
+            return i;
+
+        unsigned shift = i / SUB_BUCKETS - 1;
+        return (SUB_BUCKETS + i % SUB_BUCKETS) << shift;
+    }
+
+    static uint64_t width(size_t i)
+    {
+        if (i < SUB_BUCKETS)
+            return 1;
+        return uint64_t(1) << (i / SUB_BUCKETS - 1);
+    }
+
+    uint32_t m_buckets[NUM_BUCKETS];
+    uint64_t m_count;
+};
+
+// Numbered slots that are handed out lowest first. Free slots are tracked in
+// a bitmap, so claiming or releasing a slot doesn't have to search the items.
+template <typename T>
+class SlotTable {
+public:
+    // Number of slots, used or not
+    size_t size() const { return m_items.size(); }
+    size_t used() const { return m_used; }
+
+    // Returns the item in slot, or nullptr if it is free
+    T *get(size_t slot) const
+    {
+        return slot < m_items.size() ? m_items[slot] : nullptr;
+    }
+
+    // Puts item in the lowest free slot, adding one if there are none, and
+    // returns the slot
+    size_t claim(T *item)
+    {
+        size_t slot = m_items.size();
+
+        for (size_t w = 0; w < m_free.size(); w++) {
+            if (m_free[w]) {
+                slot = w * 64 + __builtin_ctzll(m_free[w]);
+                break;
+            }
+        }
+
+        if (slot == m_items.size()) {
+            if (slot % 64 == 0)
+                m_free.push_back(0);
+            m_items.push_back(nullptr);
+        } else {
+            m_free[slot / 64] &= ~(UINT64_C(1) << (slot % 64));
+        }
+
+        m_items[slot] = item;
+        m_used++;
+        return slot;
+    }
+
+    void release(size_t slot)
+    {
+        assert(slot < m_items.size() && m_items[slot]);
+
+        m_items[slot] = nullptr;
+        m_free[slot / 64] |= UINT64_C(1) << (slot % 64);
+        m_used--;
+    }
+
+    void clear()
+    {
+        m_items.clear();
+        m_free.clear();
+        m_used = 0;
+    }
+
+private:
+    std::vector<T*> m_items;
+    // One bit per slot, set if the slot is free
+    std::vector<uint64_t> m_free;
+    size_t m_used = 0;
+};
+
+// Set of non-zero 32-bit ids that can also be indexed like an array, e.g. to
+// pick a random member. Erasing moves the last member into the hole, so the
+// order changes, but every operation is O(1).
+class IdSet {
+public:
+    size_t size() const { return m_ids.size(); }
+    bool empty() const { return m_ids.empty(); }
+
+    uint32_t operator[](size_t i) const { return m_ids[i]; }
+
+    bool contains(uint32_t id) const { return m_positions.find(id) != nullptr; }
+
+    // Returns the index of id, or size() if it isn't in the set
+    size_t indexOf(uint32_t id) const
+    {
+        auto p = m_positions.find(id);
+        return p ? *p : m_ids.size();
+    }
+
+    bool insert(uint32_t id)
+    {
+        if (contains(id))
+            return false;
+
+        m_positions.set(id, m_ids.size());
+        m_ids.push_back(id);
+        return true;
+    }
+
+    bool erase(uint32_t id)
+    {
+        auto p = m_positions.find(id);
+        if (!p)
+            return false;
+
+        size_t i = *p;
+        uint32_t last = m_ids.back();
+
+        m_ids[i] = last;
+        m_ids.pop_back();
+        if (last != id)
+            m_positions.set(last, i);
+        m_positions.erase(id);
+        return true;
+    }
+
+    void clear()
+    {
+        m_ids.clear();
+        m_positions.clear();
+    }
+
+private:
+    std::vector<uint32_t> m_ids;
+    FlatIdMap<size_t> m_positions;
+};
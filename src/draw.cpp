@@ -19,10 +19,12 @@
 
 #include <algorithm>
 #include <cstdint>
+#include <initializer_list>
 #include <string>
 #include <map>
 #include <memory>
-#include <unordered_set>
+#include <set>
+#include <vector>
 #include <iomanip>
 
 #include <assert.h>
@@ -35,10 +37,86 @@
 #include "draw.hpp"
 
 class Column;
+struct ColumnView;
+
+struct HostCache;
+
+// A host's value in the sort column, as of when it was last sorted.
+// Numeric columns use num, the others str
+struct SortKey {
+    double num = 0;
+    std::string str;
+
+    bool operator==(SortKey const &other) const
+    {
+        return num == other.num && str == other.str;
+    }
+
+    bool operator!=(SortKey const &other) const { return !(*this == other); }
+
+    bool operator<(SortKey const &other) const
+    {
+        if (num != other.num)
+            return num < other.num;
+        return str < other.str;
+    }
+};
+
+struct SortEntry {
+    SortKey key;
+    uint32_t id;
+    std::shared_ptr<const HostCache> cache;
+};
+
+// Orders hosts by their key, then by ID so that hosts with the same key
+// always come out in the same order
+class SortOrder {
+public:
+    explicit SortOrder(bool reversed = false) : m_reversed(reversed) {}
+
+    bool operator()(SortEntry const &a, SortEntry const &b) const
+    {
+        if (a.key < b.key)
+            return !m_reversed;
+        if (b.key < a.key)
+            return m_reversed;
+        return a.id < b.id;
+    }
+
+private:
+    bool m_reversed;
+};
+
+typedef std::set<SortEntry, SortOrder> SortIndex;
+
+struct HostCache {
+    typedef std::vector<std::shared_ptr<const HostCache> > List;
+
+    // Formatted text of a column for the host. Cells are formatted on demand
+    // and kept until the host changes
+    struct Cell {
+        std::string text;
+        bool valid = false;
+    };
+
+    std::shared_ptr<Host> host;
+    mutable std::vector<Cell> cells;
+
+    // Position in the sort index, if sorted is set
+    mutable SortIndex::iterator sort_pos;
+    mutable bool sorted = false;
+
+    void invalidate() const
+    {
+        for (auto &c : cells)
+            c.valid = false;
+    }
+};
 
 class NCursesInterface: public UserInterface {
 public:
-    NCursesInterface();
+    // screen is the terminal to draw on, or nullptr for the one on stdout
+    explicit NCursesInterface(SCREEN *screen = nullptr, int input_fd = STDIN_FILENO);
     virtual ~NCursesInterface();
 
     virtual void triggerRedraw() override;
@@ -46,7 +124,7 @@ public:
 
     virtual int getInputFd() override
     {
-        return STDIN_FILENO;
+        return input_fd;
     }
 
     virtual void suspend() override;
@@ -55,6 +133,12 @@ public:
     virtual void set_anonymize(bool a) override
     {
         anonymize = a;
+        full_repaint = true;
+
+        // Names are formatted differently
+        for (auto const &c : host_caches)
+            c.second->invalidate();
+        widths_valid = false;
     }
 
     bool get_anonymize() const
@@ -62,18 +146,133 @@ public:
         return anonymize;
     }
 
-    void print_job_graph(Job::Map const &jobs, int max_graph_jobs, int max_host_jobs) const;
+    // Draws a graph of the active jobs counted in a histogram
+    void print_job_graph(int max_host_jobs, int max_graph_width, JobHistogram const &graph) const;
+
+    // Draws the newest samples of a utilization series as a sparkline of
+    // width characters, with full busy slots as the highest bar. Samples
+    // that haven't been taken yet are left blank on the left
+    template <typename T>
+    void print_sparkline(RingBuffer<T> const &samples, size_t full, int width) const
+    {
+        static const wchar_t bars[] = L" \u2581\u2582\u2583\u2584\u2585\u2586\u2587\u2588";
+        static const int num_bars = 8;
+
+        if (width <= 0)
+            return;
+
+        std::wstring line(width, L' ');
+        size_t n = std::min<size_t>(samples.size(), width);
+        for (size_t i = 0; i < n; i++) {
+            double value = samples[samples.size() - n + i];
+
+            // Anything busy gets at least the lowest bar
+            int bar = full ? ceil(value * num_bars / full) : num_bars;
+            if (!value)
+                bar = 0;
+            line[width - n + i] = bars[std::min(bar, num_bars)];
+        }
+        addwstr(line.c_str());
+    }
+
+    // Level of the utilization series shown in the sparklines
+    size_t get_utilization_level() const
+    {
+        return utilization_level;
+    }
 
 private:
     static gboolean on_idle_draw(gpointer user_data);
     static gboolean on_redraw_timer(gpointer user_data);
 
+    // Everything that decides where things are on screen. If it differs
+    // from the last frame, the host list is repainted in full; otherwise only
+    // the rows of dirty hosts are
+    struct Layout {
+        int screen_rows = -1;
+        int screen_cols = -1;
+        int first_row = 0;
+        // Column positions and widths
+        std::vector<std::pair<int, int> > columns;
+        // Visible hosts, in display order, and the rows each one uses
+        std::vector<uint32_t> hosts;
+        std::vector<size_t> host_rows;
+
+        bool operator==(Layout const &other) const
+        {
+            return screen_rows == other.screen_rows && screen_cols == other.screen_cols &&
+                first_row == other.first_row && columns == other.columns &&
+                hosts == other.hosts && host_rows == other.host_rows;
+        }
+
+        bool operator!=(Layout const &other) const { return !(*this == other); }
+    };
+
     void init();
     void doRender();
     void doRedraw();
+    void renderHost(int &row, int screen_rows, std::shared_ptr<const HostCache> const &cache,
+            std::vector<ColumnView> const &views);
+    size_t getHostRows(Host const &host) const;
+    void markHostDirty(uint32_t id);
+    bool isHostDirty(uint32_t id) const;
     int assign_color(int fg, int bg);
 
-    std::vector<uint32_t> host_order;
+    void syncHostList();
+    void updateSortIndex();
+    void eraseSorted(SortIndex::iterator pos);
+    SortIndex::iterator insertSorted(SortEntry &&entry);
+    void stepSorted(SortIndex::iterator &it, long delta) const;
+    void sortHost(std::shared_ptr<const HostCache> const &cache);
+    long getPageSize() const;
+    void setHighlight();
+
+    struct GraphSlots {
+        int num_slots = 0;
+        int remainder = 0;
+    };
+
+    Layout layout;
+    bool full_repaint = true;
+
+    // Scratch space for print_job_graph
+    mutable std::vector<GraphSlots> graph_slots;
+
+    std::map<uint32_t, std::shared_ptr<HostCache> > host_caches;
+
+    // Every host, in display order. Hosts are only repositioned when they
+    // change; the whole index is rebuilt when the sort column or direction
+    // changes
+    SortIndex sort_index;
+    bool sort_valid = false;
+    // Set when the sort keys of every host may have changed with time. Each
+    // host is checked, but only the ones whose key changed are moved
+    bool sort_timed = false;
+    // First visible host. It keeps its position in the list when hosts
+    // before it are added or removed, like an offset would, but moving it
+    // only costs as much as the distance it moves
+    SortIndex::iterator scroll_anchor = sort_index.end();
+    long scroll_delta = 0;
+    long cursor_delta = 0;
+    // Set to move the cursor to the first (-1) or last (1) host, before
+    // the deltas are applied
+    int cursor_jump = 0;
+    bool cursor_moved = false;
+    uint32_t highlighted_host = 0;
+
+    // Width constraints of the columns for the visible hosts. Only
+    // recalculated when the visible hosts or their values change
+    std::vector<std::pair<size_t, size_t> > column_widths;
+    bool widths_valid = false;
+    // Hosts that need redrawing for reasons of the interface's own, on top of
+    // the model changes
+    FlatIdMap<bool> dirty_hosts;
+    // Names of the networks the cells were formatted with
+    std::vector<std::string> network_names;
+
+    SCREEN *screen;
+    int input_fd;
+
     std::vector<std::shared_ptr<Column> > columns;
     GlibSource idle_source;
     GlibSource redraw_source;
@@ -83,19 +282,11 @@ private:
     uint32_t current_host = 0;
     size_t current_col = 0;
     bool sort_reversed = false;
+    size_t utilization_level = 0;
     int next_color_id = 1;
     bool anonymize = false;
 };
 
-struct HostCache {
-    typedef std::vector<std::shared_ptr<HostCache> > List;
-
-    std::shared_ptr<Host> host;
-    Job::Map pending_jobs;
-    Job::Map active_jobs;
-    Job::Map current_jobs;
-};
-
 class Attr {
     public:
         Attr(int a, bool on=true) : m_attr(a), m_on(false)
@@ -145,18 +336,15 @@ class Attr {
 
 class Column {
     public:
-        typedef bool (*Compare)(const std::shared_ptr<const HostCache> &, const std::shared_ptr<const HostCache> &);
-
         virtual ~Column() {}
 
         virtual std::pair<size_t, size_t> getWidthConstraint(HostCache::List const &hosts) const
         {
             size_t min_width = std::max(getHeader().size(), getMinWidth());
 
-            for (auto const &h : hosts) {
-                std::string s = getOutputString(h);
-                min_width = std::max(min_width, s.size());
-            }
+            for (auto const &h : hosts)
+                min_width = std::max(min_width, getCell(h).size());
+
             return std::pair<size_t, size_t>(min_width, min_width);
         }
 
@@ -165,14 +353,42 @@ class Column {
         virtual void output(int row, int column, int /* width */, const std::shared_ptr<const HostCache> &host) const
         {
             move(row, column);
-            addstr(getOutputString(host).c_str());
+            addstr(getCell(host).c_str());
+        }
+
+        virtual SortKey getSortKey(const std::shared_ptr<const HostCache> &host) const = 0;
+
+        // Whether the column changes as time passes, without the host
+        // changing
+        virtual bool changesWithTime() const
+        {
+            return false;
         }
 
-        virtual Compare get_compare() const = 0;
+        // Position of the column's cell in each HostCache
+        void setIndex(size_t index)
+        {
+            m_index = index;
+        }
 
     protected:
         explicit Column(const NCursesInterface *const interface): m_interface(interface) {}
 
+        // Returns the output string for the host, formatting it only if the
+        // cached one was invalidated
+        std::string const &getCell(const std::shared_ptr<const HostCache> &host) const
+        {
+            if (host->cells.size() <= m_index)
+                host->cells.resize(m_index + 1);
+
+            auto &cell = host->cells[m_index];
+            if (!cell.valid) {
+                cell.text = getOutputString(host);
+                cell.valid = true;
+            }
+            return cell.text;
+        }
+
         virtual std::string getOutputString(const std::shared_ptr<const HostCache> &) const
         {
             return "";
@@ -184,6 +400,7 @@ class Column {
         }
 
         const NCursesInterface *const m_interface;
+        size_t m_index = 0;
 };
 
 class NameColumn: public Column {
@@ -201,13 +418,15 @@ class NameColumn: public Column {
             move(row, column);
             {
                 Attr attr(COLOR_PAIR(host->host->getColor()) | ( host->host->getNoRemote() ? A_UNDERLINE : 0 ));
-                addstr(getOutputString(host).c_str());
+                addstr(getCell(host).c_str());
             }
         }
 
-        virtual Compare get_compare() const override
+        virtual SortKey getSortKey(const std::shared_ptr<const HostCache> &host) const override
         {
-            return compare;
+            SortKey key;
+            key.str = host->host->getName();
+            return key;
         }
 
     protected:
@@ -216,18 +435,12 @@ class NameColumn: public Column {
             std::ostringstream ss;
             if (m_interface->get_anonymize()) {
                 ss << std::hex;
-                ss << "Host " << std::hash<std::string>{}(host->host->getName());
+                ss << "Host " << host->host->getProfile().name_hash;
             } else {
                 ss << host->host->getName();
             }
             return ss.str();
         }
-
-    private:
-        static bool compare(const std::shared_ptr<const HostCache> &a, const std::shared_ptr<const HostCache> &b)
-        {
-            return a->host->getName() < b->host->getName();
-        }
 };
 
 class JobsColumn: public Column {
@@ -254,18 +467,14 @@ class JobsColumn: public Column {
         virtual void output(int row, int column, int width, const std::shared_ptr<const HostCache> &host) const override
         {
             move(row, column);
-            m_interface->print_job_graph(host->current_jobs, host->host->getMaxJobs(), width);
+            m_interface->print_job_graph(host->host->getMaxJobs(), width, host->host->getJobGraph());
         }
 
-        virtual Compare get_compare() const override
+        virtual SortKey getSortKey(const std::shared_ptr<const HostCache> &host) const override
         {
-            return compare;
-        }
-
-    private:
-        static bool compare(const std::shared_ptr<const HostCache> &a, const std::shared_ptr<const HostCache> &b)
-        {
-            return a->current_jobs.size() < b->current_jobs.size();
+            SortKey key;
+            key.num = host->host->getCurrentJobs().size();
+            return key;
         }
 };
 
@@ -275,30 +484,176 @@ class JobsColumn: public Column {
             _name(const NCursesInterface *const interface): Column(interface) {} \
             virtual ~_name() {} \
             virtual std::string getHeader() const override { return _header; } \
-            virtual Compare get_compare() const override { return compare; } \
+            virtual SortKey getSortKey(const std::shared_ptr<const HostCache> &host) const override \
+            { \
+                SortKey key; key.num = host->_attr; return key; \
+            } \
         protected: \
             virtual std::string getOutputString(const std::shared_ptr<const HostCache> &host) const override \
             { \
                 std::ostringstream ss; ss << std::setprecision(6) << host->_attr; return ss.str(); \
             } \
             virtual size_t getMinWidth() const override { return _min_width; } \
-        private: \
-            static bool compare(const std::shared_ptr<const HostCache> &a, const std::shared_ptr<const HostCache> &b) \
-            { \
-                return a->_attr < b->_attr; \
-            } \
     }
 
 SIMPLE_COLUMN(InJobsColumn, "IN", host->total_in, 5);
 SIMPLE_COLUMN(OutJobsColumn, "OUT", host->total_out, 5);
-SIMPLE_COLUMN(ActiveJobsColumn, "ACTIVE", active_jobs.size(), 0);
-SIMPLE_COLUMN(PendingJobsColumn, "PENDING", pending_jobs.size(), 0);
+SIMPLE_COLUMN(ActiveJobsColumn, "ACTIVE", host->getActiveJobs().size(), 0);
+SIMPLE_COLUMN(PendingJobsColumn, "PENDING", host->getPendingJobs().size(), 0);
 SIMPLE_COLUMN(LocalJobsColumn, "LOCAL", host->total_local, 5);
-SIMPLE_COLUMN(CurrentJobsColumn, "CUR", current_jobs.size(), 0);
+SIMPLE_COLUMN(CurrentJobsColumn, "CUR", host->getCurrentJobs().size(), 0);
 SIMPLE_COLUMN(MaxJobsColumn, "MAX", host->getMaxJobs(), 0);
 SIMPLE_COLUMN(IDColumn, "ID", host->id, 0);
+
+// Only shown when there are several networks
+class NetworkColumn: public Column {
+    public:
+        explicit NetworkColumn(const NCursesInterface *const interface): Column(interface) {}
+        virtual ~NetworkColumn() {}
+
+        virtual std::string getHeader() const override
+        {
+            return "NET";
+        }
+
+        virtual SortKey getSortKey(const std::shared_ptr<const HostCache> &host) const override
+        {
+            SortKey key;
+            key.str = getOutputString(host);
+            return key;
+        }
+
+    protected:
+        virtual std::string getOutputString(const std::shared_ptr<const HostCache> &host) const override
+        {
+            size_t network = host->host->getNetwork();
+            return network < scheduler->getNetworkCount() ? scheduler->getNetwork(network).getNetName() : "";
+        }
+};
 SIMPLE_COLUMN(SpeedColumn, "SPEED", host->getSpeed(), 0);
 
+// Formats a wait in microseconds with a unit that keeps it short
+static std::string format_wait(uint64_t us)
+{
+    std::ostringstream ss;
+    if (us < 1000000)
+        ss << us / 1000 << "ms";
+    else if (us < 600000000)
+        ss << std::fixed << std::setprecision(1) << us / 1000000.0 << "s";
+    else
+        ss << us / 60000000 << "m";
+    return ss.str();
+}
+
+// A percentile of the time the jobs of the host waited for a compile server
+class WaitColumn: public Column {
+    public:
+        WaitColumn(const NCursesInterface *const interface, std::string const &header, double percentile):
+            Column(interface), m_header(header), m_percentile(percentile) {}
+        virtual ~WaitColumn() {}
+
+        virtual std::string getHeader() const override
+        {
+            return m_header;
+        }
+
+        // Hosts with no waits recorded sort before hosts whose jobs didn't wait
+        virtual SortKey getSortKey(const std::shared_ptr<const HostCache> &host) const override
+        {
+            auto const &waits = host->host->getWaitTimes();
+
+            SortKey key;
+            key.num = waits.empty() ? -1 : waits.percentile(m_percentile);
+            return key;
+        }
+
+    protected:
+        virtual std::string getOutputString(const std::shared_ptr<const HostCache> &host) const override
+        {
+            auto const &waits = host->host->getWaitTimes();
+
+            if (waits.empty())
+                return "-";
+            return format_wait(waits.percentile(m_percentile));
+        }
+
+    private:
+        std::string m_header;
+        double m_percentile;
+};
+
+// Number of samples in the utilization sparklines of the hosts
+#define SPARKLINE_WIDTH (30)
+
+// The recent busy slots of the host as a sparkline
+class UtilizationColumn: public Column {
+    public:
+        explicit UtilizationColumn(const NCursesInterface *const interface): Column(interface) {}
+        virtual ~UtilizationColumn() {}
+
+        virtual std::pair<size_t, size_t> getWidthConstraint(HostCache::List const &) const override
+        {
+            size_t min_width = getHeader().size();
+            return std::pair<size_t, size_t>(min_width, std::max<size_t>(min_width, SPARKLINE_WIDTH));
+        }
+
+        virtual std::string getHeader() const override
+        {
+            unsigned interval = Host::getUtilizationInterval(m_interface->get_utilization_level());
+
+            std::ostringstream ss;
+            ss << "UTIL/";
+            if (interval % 60 == 0)
+                ss << interval / 60 << "m";
+            else
+                ss << interval << "s";
+            return ss.str();
+        }
+
+        virtual void output(int row, int column, int width, const std::shared_ptr<const HostCache> &host) const override
+        {
+            move(row, column);
+            m_interface->print_sparkline(getSamples(host), host->host->getMaxJobs() * UTILIZATION_SCALE, width);
+        }
+
+        // Sorted by the fraction of the slots in use in the latest sample
+        virtual SortKey getSortKey(const std::shared_ptr<const HostCache> &host) const override
+        {
+            auto const &samples = getSamples(host);
+            size_t max_jobs = host->host->getMaxJobs();
+
+            SortKey key;
+            if (!samples.empty())
+                key.num = max_jobs ? samples.back() / double(max_jobs * UTILIZATION_SCALE) : samples.back();
+            return key;
+        }
+
+        virtual bool changesWithTime() const override
+        {
+            return true;
+        }
+
+    private:
+        RingBuffer<uint16_t> const &getSamples(const std::shared_ptr<const HostCache> &host) const
+        {
+            return host->host->getUtilization().getLevel(m_interface->get_utilization_level());
+        }
+};
+
+struct ColumnView {
+    size_t idx;
+    int col;
+    int width;
+    int min_width;
+    int desired_width;
+    std::shared_ptr<Column> column;
+
+    bool hasSlack() const
+    {
+        return desired_width != min_width;
+    }
+};
+
 static const std::string local_job_track("abcdefghijklmnopqrstuvwxyz");
 static const std::string remote_job_track("ABCDEFGHIJKLMNOPQRSTUVWXYZ");
 
@@ -307,49 +662,76 @@ int NCursesInterface::processInput()
     int c = getch();
     auto cur_host = Host::find(current_host);
     bool consumed = true;
+    long page = getPageSize();
 
-    if (cur_host)
-        cur_host->highlighted = false;
-    else
+    if (!cur_host)
         current_host = 0;
 
+    // Cursor and scroll movements are resolved when rendering, since only
+    // the visible part of the host list is sorted
     switch(c) {
     case KEY_UP:
     case 'k':
-        if (cur_host) {
-            if (cur_host->current_position > 0) {
-                current_host = host_order[cur_host->current_position - 1];
-            }
-        } else {
-            current_host = host_order[0];
-        }
+        cursor_delta--;
+        cursor_moved = true;
         break;
 
     case KEY_DOWN:
     case 'j':
-        if (cur_host) {
-            if (cur_host->current_position < host_order.size() - 1) {
-                current_host = host_order[cur_host->current_position + 1];
-            }
-        } else {
-            current_host = host_order[0];
-        }
+        cursor_delta++;
+        cursor_moved = true;
+        break;
+
+    case KEY_PPAGE:
+        scroll_delta -= page;
+        cursor_delta -= page;
+        cursor_moved = true;
+        full_repaint = true;
+        break;
+
+    case KEY_NPAGE:
+        scroll_delta += page;
+        cursor_delta += page;
+        cursor_moved = true;
+        full_repaint = true;
+        break;
+
+    case KEY_HOME:
+        cursor_jump = -1;
+        scroll_delta = 0;
+        cursor_delta = 0;
+        cursor_moved = true;
+        full_repaint = true;
+        break;
+
+    case KEY_END:
+        cursor_jump = 1;
+        scroll_delta = 0;
+        cursor_delta = 0;
+        cursor_moved = true;
+        full_repaint = true;
         break;
 
     case KEY_LEFT:
     case 'h':
         if (current_col > 0)
             current_col--;
+        full_repaint = true;
+        sort_valid = false;
         break;
 
     case KEY_RIGHT:
     case 'l':
         if (current_col < columns.size() - 1)
             current_col++;
+        full_repaint = true;
+        sort_valid = false;
         break;
 
     case '\t':
         current_col = (current_col + 1) % columns.size();
+        full_repaint = true;
+        sort_valid = false;
         break;
 
     case ' ':
@@ -365,6 +747,20 @@ int NCursesInterface::processInput()
 
     case 'r':
         sort_reversed = !sort_reversed;
+        full_repaint = true;
+        sort_valid = false;
+        break;
+
+    case 'u':
+        utilization_level = (utilization_level + 1) % Host::farm_utilization.levels();
+        full_repaint = true;
+        sort_valid = false;
+        widths_valid = false;
+        break;
+
+    case KEY_RESIZE:
+        full_repaint = true;
+        consumed = false;
         break;
 
     case 'q':
@@ -376,9 +772,6 @@ int NCursesInterface::processInput()
         break;
     }
 
-    if (current_host)
-        Host::hosts.at(current_host)->highlighted = true;
-
     triggerRedraw();
     return consumed ? 0 : c;
 }
@@ -396,53 +789,15 @@ void NCursesInterface::resume()
     init();
 }
 
-void NCursesInterface::print_job_graph(Job::Map const &jobs, int max_host_jobs, int max_graph_width) const
+void NCursesInterface::print_job_graph(int max_host_jobs, int max_graph_width, JobHistogram const &graph) const
 {
-    struct Bin {
-        int color = 0;
-        bool is_local = false;
-        int num_jobs = 0;
-        int num_slots = 0;
-        int remainder = 0;
-
-        Bin(int color, bool is_local, int num_jobs):
-            color(color), is_local(is_local), num_jobs(num_jobs)
-        {}
-    };
-
     // Only compress the jobs into a smaller or equal number of slots. Don't
     // expand them
     int max_graph_jobs = std::min(max_graph_width - 2, max_host_jobs);
     bool is_scaled = max_graph_jobs < max_host_jobs;
 
-    std::vector<Bin> bins;
-    int total_active_jobs = 0;
-
-    for (auto const &j : jobs) {
-        if (!j.second->active)
-            continue;
-
-        total_active_jobs++;
-
-        int color = 0;
-        auto const h = j.second->getClient();
-        if (h)
-            color = h->getColor();
-
-        bool is_local = j.second->is_local;
-
-        bool found_bin = false;
-        for (auto& b : bins) {
-            if (b.color == color && b.is_local == is_local) {
-                b.num_jobs++;
-                found_bin = true;
-            }
-        }
-
-        if (!found_bin) {
-            bins.emplace_back(color, is_local, 1);
-        }
-    }
+    auto const &bins = graph.getBins();
+    int total_active_jobs = graph.total();
 
     // If there are nodes that do not accept remote jobs but are performing
     // local compiles, it is possible that the number of active jobs exceeds
@@ -452,37 +807,37 @@ void NCursesInterface::print_job_graph(Job::Map const &jobs, int max_host_jobs,
     // event it would exceed the allocated space.
     max_host_jobs = std::max(total_active_jobs, max_host_jobs);
 
-    int active_graph_slots = ceil(max_graph_jobs * total_active_jobs / (double)max_host_jobs);
+    int active_graph_slots = 0;
+    if (max_host_jobs > 0)
+        active_graph_slots = ceil(max_graph_jobs * total_active_jobs / (double)max_host_jobs);
     int used_graph_slots = 0;
 
     // Calculate the whole and remainder slots for each bin
-    for (auto& b : bins) {
-        b.num_slots = (b.num_jobs * active_graph_slots) / total_active_jobs;
-        b.remainder = (b.num_jobs * active_graph_slots) % total_active_jobs;
+    graph_slots.resize(bins.size());
+    for (size_t i = 0; i < bins.size(); i++) {
+        auto &s = graph_slots[i];
+        s.num_slots = (bins[i].count * active_graph_slots) / total_active_jobs;
+        s.remainder = (bins[i].count * active_graph_slots) % total_active_jobs;
 
-        used_graph_slots += b.num_slots;
+        used_graph_slots += s.num_slots;
     }
 
-    // Add a slot to the bin with the highest remainders until we run out of graph slots
-    std::sort(bins.begin(), bins.end(), [](Bin const& a, Bin const& b) -> bool { return a.remainder > b.remainder; });
-    for (auto& b : bins) {
-        if (used_graph_slots == active_graph_slots || b.remainder == 0)
+    // Add a slot to the bin with the highest remainders until we run out of
+    // graph slots. There are only a handful of bins
+    while (used_graph_slots < active_graph_slots) {
+        auto best = std::max_element(graph_slots.begin(), graph_slots.end(),
+                [](GraphSlots const &a, GraphSlots const &b) { return a.remainder < b.remainder; });
+
+        if (best == graph_slots.end() || best->remainder == 0)
             break;
 
-        b.num_slots++;
+        best->num_slots++;
+        best->remainder = 0;
         used_graph_slots++;
     }
 
     assert(used_graph_slots == active_graph_slots);
 
-    // Sort by color/local to keep the display ordering stable. Otherwise, it
-    // jumps around unpleasantly.
-    std::sort(bins.begin(), bins.end(), [](Bin const& a, Bin const& b) -> bool {
-        if (a.is_local != b.is_local)
-            return a.is_local > b.is_local;
-        return a.color < b.color;
-    });
-
     if (is_scaled)
         addch('{');
     else
@@ -490,15 +845,16 @@ void NCursesInterface::print_job_graph(Job::Map const &jobs, int max_host_jobs,
 
     int cnt = 0;
 
-    for (auto const& b : bins) {
-        Attr clr(COLOR_PAIR(b.color));
+    // Bins are already in display order, which keeps the graph stable
+    for (size_t i = 0; i < bins.size(); i++) {
+        Attr clr(COLOR_PAIR(bins[i].color));
 
-        char c = b.is_local ? '%' : '=';
+        char c = bins[i].is_local ? '%' : '=';
 
-        for (int i = 0; i < b.num_slots; i++)
+        for (int j = 0; j < graph_slots[i].num_slots; j++)
             addch(c);
 
-        cnt += b.num_slots;
+        cnt += graph_slots[i].num_slots;
     }
 
     for (int i = cnt; i < max_graph_jobs; ++i)
@@ -521,6 +877,24 @@ gboolean NCursesInterface::on_idle_draw(gpointer user_data)
 gboolean NCursesInterface::on_redraw_timer(gpointer user_data)
 {
     auto *self = static_cast<NCursesInterface*>(user_data);
+
+    bool timed_columns = false;
+    for (auto const &c : self->columns)
+        timed_columns = timed_columns || c->changesWithTime();
+
+    // The run times of the jobs on expanded hosts tick over, and so do the
+    // timed columns of every host. Only the rows on screen are redrawn;
+    // hosts that scroll into view change the layout and are drawn in full
+    for (auto id : self->layout.hosts) {
+        auto host = Host::find(id);
+        if (timed_columns || (host && host->expanded))
+            self->markHostDirty(id);
+    }
+
+    // The hosts may have moved if they are sorted by a timed column
+    if (self->columns[self->current_col]->changesWithTime())
+        self->sort_timed = true;
+
     self->triggerRedraw();
     return TRUE;
 }
@@ -532,74 +906,268 @@ int NCursesInterface::assign_color(int fg, int bg)
     return ident;
 }
 
-void NCursesInterface::doRender()
+void NCursesInterface::markHostDirty(uint32_t id)
 {
-    int total_job_slots = 0;
-    int avail_servers = 0;
+    if (id)
+        dirty_hosts.set(id, true);
+}
 
-    int screen_rows;
-    int screen_cols;
-    std::unordered_set<uint32_t> used_hosts;
+bool NCursesInterface::isHostDirty(uint32_t id) const
+{
+    return dirty_hosts.find(id) || model_changes.getHosts().find(id);
+}
 
-    getmaxyx(stdscr, screen_rows, screen_cols);
+// Keeps the host list in step with the hosts in the model
+void NCursesInterface::syncHostList()
+{
+    if (!model_changes.getLayoutChanged() && host_caches.size() == Host::hosts.size())
+        return;
 
-    HostCache::List host_cache;
+    std::map<uint32_t, std::shared_ptr<HostCache> > caches;
+    std::vector<std::shared_ptr<HostCache> > added;
+    for (auto const &h : Host::hosts) {
+        auto i = host_caches.find(h.first);
+        if (i != host_caches.end() && i->second->host == h.second) {
+            caches.insert(*i);
+            host_caches.erase(i);
+        } else {
+            auto c = std::make_shared<HostCache>();
+            c->host = h.second;
+            caches.emplace(h.first, c);
+            added.push_back(c);
+        }
+    }
 
-    for (auto &j : Job::allJobs) {
-        if (j.second->getHost()) {
-            used_hosts.insert(j.second->getHost()->id);
+    // Whatever is left is gone from the model. This has to be done before
+    // adding new hosts, which can have the same ID as an old one
+    for (auto const &c : host_caches) {
+        if (c.second->sorted) {
+            eraseSorted(c.second->sort_pos);
+            c.second->sorted = false;
         }
     }
 
-    for (auto const &h : Host::hosts) {
-        if (!h.second->getNoRemote()) {
-            avail_servers++;
-            total_job_slots += h.second->getMaxJobs();
+    host_caches.swap(caches);
+
+    if (sort_valid) {
+        for (auto const &c : added)
+            sortHost(c);
+    }
+}
+
+// Inserts the host into the sort index, or moves it if its key changed
+void NCursesInterface::sortHost(std::shared_ptr<const HostCache> const &cache)
+{
+    SortKey key;
+    if (current_col < columns.size())
+        key = columns[current_col]->getSortKey(cache);
+
+    // NaN doesn't order, which would corrupt the index
+    if (std::isnan(key.num))
+        key.num = 0;
+
+    if (cache->sorted) {
+        if (cache->sort_pos->key == key)
+            return;
+        eraseSorted(cache->sort_pos);
+    }
+
+    SortEntry entry;
+    entry.key = std::move(key);
+    entry.id = cache->host->id;
+    entry.cache = cache;
+
+    cache->sort_pos = insertSorted(std::move(entry));
+    cache->sorted = true;
+}
+
+// Removes an entry from the sort index. If it is the first visible host or
+// comes before it, the next host takes its place at the top of the view
+void NCursesInterface::eraseSorted(SortIndex::iterator pos)
+{
+    if (scroll_anchor != sort_index.end() && !sort_index.key_comp()(*scroll_anchor, *pos))
+        ++scroll_anchor;
+
+    sort_index.erase(pos);
+}
+
+// Adds an entry to the sort index. If it comes before the first visible host,
+// the view moves back by one so that it stays at the same position
+SortIndex::iterator NCursesInterface::insertSorted(SortEntry &&entry)
+{
+    auto pos = sort_index.insert(std::move(entry)).first;
+
+    if (scroll_anchor == sort_index.end()) {
+        // The view of an empty list starts at the top
+        if (sort_index.size() == 1)
+            scroll_anchor = pos;
+    } else if (sort_index.key_comp()(*pos, *scroll_anchor)) {
+        --scroll_anchor;
+    }
+
+    return pos;
+}
+
+// Moves an iterator of the sort index by up to delta entries, stopping at
+// the start or the end of the index
+void NCursesInterface::stepSorted(SortIndex::iterator &it, long delta) const
+{
+    for (; delta > 0 && it != sort_index.end(); delta--)
+        ++it;
+    for (; delta < 0 && it != sort_index.begin(); delta++)
+        --it;
+}
+
+void NCursesInterface::updateSortIndex()
+{
+    if (!sort_valid) {
+        // The whole index is sorted anyway, so the view can be found by its
+        // offset again
+        size_t offset = std::distance(sort_index.begin(), scroll_anchor);
+
+        sort_index = SortIndex(SortOrder(sort_reversed));
+        scroll_anchor = sort_index.end();
+        for (auto const &c : host_caches) {
+            c.second->sorted = false;
+            sortHost(c.second);
         }
-        auto c = std::make_shared<HostCache>();
-        c->host = h.second;
-        c->pending_jobs = c->host->getPendingJobs();
-        c->active_jobs = c->host->getActiveJobs();
-        c->current_jobs = c->host->getCurrentJobs();
+        scroll_anchor = std::next(sort_index.begin(), std::min(offset, sort_index.size()));
+        sort_valid = true;
+        sort_timed = false;
+        return;
+    }
+
+    if (sort_timed) {
+        for (auto const &c : host_caches)
+            sortHost(c.second);
+        sort_timed = false;
+        return;
+    }
+
+    // Only hosts that changed can have moved
+    model_changes.getHosts().forEach([this](uint32_t id, bool) {
+        auto i = host_caches.find(id);
+        if (i != host_caches.end())
+            sortHost(i->second);
+    });
+}
+
+// Number of host rows that fit on the screen
+long NCursesInterface::getPageSize() const
+{
+    return std::max(layout.screen_rows - layout.first_row - 1, 1);
+}
+
+void NCursesInterface::setHighlight()
+{
+    if (highlighted_host == current_host)
+        return;
+
+    auto old_host = Host::find(highlighted_host);
+    if (old_host) {
+        old_host->highlighted = false;
+        markHostDirty(old_host->id);
+    }
+
+    auto new_host = Host::find(current_host);
+    if (new_host) {
+        new_host->highlighted = true;
+        markHostDirty(new_host->id);
+    }
+
+    highlighted_host = current_host;
+}
+
+// Number of screen rows a host takes up in the list
+size_t NCursesInterface::getHostRows(Host const &host) const
+{
+    if (!host.expanded)
+        return 1;
 
-        host_cache.push_back(c);
+    size_t rows = 1 + host.getMaxJobs();
+    for (auto const &a : host.attr) {
+        if (get_anonymize() && (a.first == "Name" || a.first == "IP"))
+            continue;
+        rows++;
     }
+    return rows;
+}
+
+void NCursesInterface::doRender()
+{
+    auto const &totals = Host::getTotals();
+    int total_job_slots = totals.slots;
+
+    int screen_rows;
+    int screen_cols;
+
+    getmaxyx(stdscr, screen_rows, screen_cols);
+
+    size_t num_networks = scheduler->getNetworkCount();
 
     int row = 0;
     #define next_row() if (++row >= screen_rows) return
+    // The header is cheap and changes with nearly every event, so it is
+    // always redrawn. Each line is cleared first, since the screen isn't
+    // erased between frames
+    #define start_row(col) do { move(row, 0); clrtoeol(); move(row, col); } while (0)
 
-    move(row, 0);
+    // One line for each network. The lines after are for all of them
+    for (size_t i = 0; i < num_networks; i++) {
+        auto const &network = scheduler->getNetwork(i);
+
+        start_row(0);
+
+        if (!get_anonymize()) {
+            {
+                Attr bold(A_BOLD);
+                addstr("Scheduler: ");
+            }
+            addstr(network.getSchedulerName().c_str());
+            addch(' ');
+        }
 
-    if (!get_anonymize()) {
         {
             Attr bold(A_BOLD);
-            addstr("Scheduler: ");
+            addstr("Netname: ");
         }
-        addstr(scheduler->getSchedulerName().c_str());
-        addch(' ');
-    }
+        addstr(network.getNetName().c_str());
 
-    {
-        Attr bold(A_BOLD);
-        addstr("Netname: ");
+        if (num_networks > 1) {
+            std::ostringstream ss;
+            bool counted = i < totals.network_hosts.size();
+            ss << " Servers:" << (counted ? totals.network_hosts[i] : 0) <<
+                " Active:" << (counted ? totals.network_jobs[i] : 0);
+            addstr(ss.str().c_str());
+        }
+
+        if (!network.isConnected()) {
+            addch(' ');
+            Attr reverse(A_REVERSE);
+            addstr("STALE: reconnecting");
+        } else if (network.getConnectLatency()) {
+            std::ostringstream ss;
+            ss << " Connected in:" << std::fixed << std::setprecision(1) <<
+                network.getConnectLatency() / 1000.0 << "ms";
+            addstr(ss.str().c_str());
+        }
+        next_row();
     }
-    addstr(scheduler->getNetName().c_str());
-    next_row();
 
 
-    move(row, 0);
+    start_row(0);
     {
         Attr bold(A_BOLD);
         addstr("Servers: ");
     }
     {
         std::ostringstream ss;
-        ss << "Total:" << Host::hosts.size() << " Available:" << avail_servers << " Active:" << used_hosts.size();
+        ss << "Total:" << Host::hosts.size() << " Available:" << totals.available << " Active:" << totals.busy;
         addstr(ss.str().c_str());
     }
     next_row();
 
-    move(row, 0);
+    start_row(0);
     {
         Attr bold(A_BOLD);
         addstr("Total: ");
@@ -610,55 +1178,221 @@ void NCursesInterface::doRender()
         addstr(ss.str().c_str());
     }
     next_row();
-    move(row, 0);
+    start_row(0);
     {
         Attr bold(A_BOLD);
         addstr("Jobs: ");
     }
     {
         std::ostringstream ss;
-        ss << "Maximum:" << total_job_slots << " Active:" << Job::activeJobs.size() <<
+        ss << "Maximum:" << total_job_slots << " Active:" << Job::activeCount() <<
             " Local:" << Job::localJobs.size() << " Pending:" << Job::pendingJobs.size();
         addstr(ss.str().c_str());
     }
     next_row();
 
-    move(row, 6);
-    print_job_graph(Job::allJobs, total_job_slots, screen_cols - 6);
+    start_row(0);
+    {
+        Attr bold(A_BOLD);
+        addstr("Wait: ");
+    }
+    if (Job::wait_times.empty()) {
+        addstr("-");
+    } else {
+        std::ostringstream ss;
+        ss << "P50:" << format_wait(Job::wait_times.percentile(0.50)) <<
+            " P95:" << format_wait(Job::wait_times.percentile(0.95)) <<
+            " P99:" << format_wait(Job::wait_times.percentile(0.99)) <<
+            " Jobs:" << Job::wait_times.count();
+        addstr(ss.str().c_str());
+    }
     next_row();
+
+    auto ingest = scheduler->getIngestStats();
+    if (ingest.threaded) {
+        start_row(0);
+        {
+            Attr bold(A_BOLD);
+            addstr("Ingest: ");
+        }
+        {
+            std::ostringstream ss;
+            ss << "Events:" << ingest.events << " Queue:" << ingest.queue_depth << "/" << ingest.queue_capacity <<
+                " Max:" << ingest.queue_max_depth << " Stalls:" << ingest.stalls <<
+                " Blocked:" << ingest.blocked_us / 1000 << "ms";
+            addstr(ss.str().c_str());
+        }
+        next_row();
+    }
+
+    start_row(6);
+    print_job_graph(total_job_slots, screen_cols - 6, Job::graph);
     next_row();
 
-    struct ColumnView {
-        size_t idx;
-        int col;
-        int width;
-        int min_width;
-        int desired_width;
-        std::shared_ptr<Column> column;
+    start_row(0);
+    {
+        Attr bold(A_BOLD);
+        addstr("Util: ");
+    }
+    print_sparkline(Host::farm_utilization.getLevel(utilization_level), total_job_slots * UTILIZATION_SCALE,
+            screen_cols - 6);
+    next_row();
+    start_row(0);
+    next_row();
 
-        bool hasSlack() const
-        {
-            return desired_width != min_width;
+    // Lay out the host list before drawing it
+    Layout new_layout;
+    new_layout.screen_rows = screen_rows;
+    new_layout.screen_cols = screen_cols;
+    new_layout.first_row = row;
+
+    syncHostList();
+
+    // The NET cells only change with their host, except when a network is
+    // rediscovered under another name. Renames are rare, so everything is
+    // formatted and sorted again then
+    bool names_changed = network_names.size() != num_networks;
+    network_names.resize(num_networks);
+    for (size_t i = 0; i < num_networks; i++) {
+        auto name = scheduler->getNetwork(i).getNetName();
+        if (name != network_names[i]) {
+            network_names[i] = std::move(name);
+            names_changed = true;
         }
-    };
-    std::vector<ColumnView> views;
+    }
 
-    move(row, 0);
+    if (names_changed) {
+        for (auto const &c : host_caches)
+            c.second->invalidate();
+        widths_valid = false;
+        sort_valid = false;
+        full_repaint = true;
+    }
+
+    // Cells of changed hosts have to be formatted again
+    model_changes.getHosts().forEach([this](uint32_t id, bool) {
+        auto i = host_caches.find(id);
+        if (i != host_caches.end())
+            i->second->invalidate();
+    });
+
+    updateSortIndex();
+
+    long page = std::max(screen_rows - (row + 1), 1);
+
+    // The view and the cursor are stepped from where they are, so moving
+    // them only costs as much as the distance they move
+    auto first = scroll_anchor;
+    if (cursor_jump < 0)
+        first = sort_index.begin();
+    else if (cursor_jump > 0)
+        first = sort_index.end();
+    stepSorted(first, scroll_delta);
+    scroll_delta = 0;
+
+    // Fill the page from the bottom, if there are enough hosts
     {
-        Attr color(COLOR_PAIR(header_color));
-        Attr highlight(COLOR_PAIR(highlight_color), false);
+        long below = 0;
+        for (auto it = first; below < page && it != sort_index.end(); ++it)
+            below++;
+        stepSorted(first, below - page);
+    }
 
-        add_wch(sort_reversed ? WACS_UARROW : WACS_DARROW);
-        for (int i = 1; i < screen_cols; i++)
-            addch(' ');
+    auto cur_host = Host::find(current_host);
+    if (!cur_host)
+        current_host = 0;
+
+    auto cursor = sort_index.end();
+    if (cursor_moved && !sort_index.empty()) {
+        if (!cur_host) {
+            // The first movement only selects the top visible host
+            cursor = first;
+        } else {
+            if (cursor_jump < 0)
+                cursor = sort_index.begin();
+            else if (cursor_jump > 0)
+                cursor = std::prev(sort_index.end());
+            else
+                cursor = host_caches.at(current_host)->sort_pos;
+
+            stepSorted(cursor, cursor_delta);
+            if (cursor == sort_index.end())
+                --cursor;
+        }
+        current_host = cursor->id;
 
+        if (sort_index.key_comp()(*cursor, *first)) {
+            first = cursor;
+        } else {
+            long rank = 0;
+            auto it = first;
+            for (; rank < page && it != cursor; ++it)
+                rank++;
+
+            // Below the page, so it goes on the last row
+            if (it != cursor) {
+                first = cursor;
+                stepSorted(first, 1 - page);
+            }
+        }
+    }
+    cursor_moved = false;
+    cursor_delta = 0;
+    cursor_jump = 0;
+
+    if (cursor != sort_index.end()) {
+        // Expanded hosts take up more than one row. Scroll further if they
+        // push the cursor off the bottom
+        long rows = 0;
+        for (auto it = first; ; ++it) {
+            rows += getHostRows(*it->cache->host);
+            if (it == cursor)
+                break;
+        }
+
+        while (rows > page && first != cursor) {
+            rows -= getHostRows(*first->cache->host);
+            ++first;
+        }
+    }
+    scroll_anchor = first;
+
+    setHighlight();
+
+    HostCache::List visible;
+    int host_row = row + 1;
+    for (auto it = first; it != sort_index.end() && host_row < screen_rows; ++it) {
+        auto const &host = it->cache->host;
+        size_t rows = getHostRows(*host);
+
+        visible.push_back(it->cache);
+        new_layout.hosts.push_back(host->id);
+        new_layout.host_rows.push_back(rows);
+        host_row += rows;
+    }
+
+    bool widths_changed = !widths_valid || new_layout.hosts != layout.hosts;
+    for (size_t i = 0; i < visible.size() && !widths_changed; i++) {
+        if (model_changes.getHosts().find(visible[i]->host->id))
+            widths_changed = true;
+    }
+
+    if (widths_changed) {
+        column_widths.clear();
+        for (auto const &c : columns)
+            column_widths.push_back(c->getWidthConstraint(visible));
+        widths_valid = true;
+    }
+
+    std::vector<ColumnView> views;
+    {
         int max_col = 2;
         int min_col = 2;
         int slack_cols = 0;
 
         for (size_t i = 0; i < columns.size(); i++) {
             auto &c = columns[i];
-            auto width = c->getWidthConstraint(host_cache);
+            auto width = column_widths[i];
             ColumnView v;
 
             v.idx = i;
@@ -704,6 +1438,28 @@ void NCursesInterface::doRender()
                 col += v.width + 1;
             }
         }
+    }
+
+    for (auto const &v : views)
+        new_layout.columns.emplace_back(v.col, v.width);
+
+    bool full = full_repaint || new_layout != layout;
+    layout = std::move(new_layout);
+    full_repaint = false;
+
+    if (full) {
+        move(row, 0);
+        clrtobot();
+    }
+
+    move(row, 0);
+    {
+        Attr color(COLOR_PAIR(header_color));
+        Attr highlight(COLOR_PAIR(highlight_color), false);
+
+        add_wch(sort_reversed ? WACS_UARROW : WACS_DARROW);
+        for (int i = 1; i < screen_cols; i++)
+            addch(' ');
 
         // Draw headers
         for (auto const& v : views) {
@@ -724,114 +1480,113 @@ void NCursesInterface::doRender()
     }
     next_row();
 
-    if (current_col < columns.size()) {
-        auto compare = columns[current_col]->get_compare();
-        if (sort_reversed)
-            std::sort(host_cache.rbegin(), host_cache.rend(), compare);
-        else
-            std::sort(host_cache.begin(), host_cache.end(), compare);
-    }
-
-    host_order.clear();
+    for (size_t i = 0; i < visible.size(); i++) {
+        auto const &cache = visible[i];
+        auto const &host = cache->host;
 
-    for (auto cache: host_cache) {
-        auto &host = cache->host;
-        if (!host->id)
+        if (!full && !isHostDirty(host->id)) {
+            row += layout.host_rows[i];
+            if (row >= screen_rows)
+                return;
             continue;
-
-        host->current_position = host_order.size();
-        host_order.push_back(host->id);
-
-        move(row, 0);
-        {
-            Attr color(COLOR_PAIR(host->highlighted ? highlight_color : expand_color));
-            addch(host->expanded ? '-' : '+');
         }
 
-        for (auto const &v: views) {
-            if (v.col + v.width <= screen_cols)
-                v.column->output(row, v.col, v.width, cache);
+        if (!full) {
+            for (size_t r = 0; r < layout.host_rows[i] && row + (int)r < screen_rows; r++) {
+                move(row + r, 0);
+                clrtoeol();
+            }
         }
 
-        if (host->expanded) {
-            for (size_t i = 0; i < host->getMaxJobs(); i++) {
-                next_row();
-                move(row, 2);
-                {
-                    Attr bold(A_BOLD);
-                    printw("Job %ld: ", i + 1);
-                }
+        renderHost(row, screen_rows, cache, views);
+        if (row >= screen_rows)
+            return;
+    }
 
-                std::shared_ptr<Job> job;
+    #undef start_row
+    #undef next_row
+}
 
-                // Find assigned job
-                for (auto j : cache->current_jobs) {
-                    if (j.second->host_slot == i) {
-                        job = j.second;
-                        break;
-                    }
-                }
+// Draws the row of a host, and its details if it is expanded. row is left
+// on the row after the last one drawn
+void NCursesInterface::renderHost(int &row, int screen_rows, std::shared_ptr<const HostCache> const &cache,
+        std::vector<ColumnView> const &views)
+{
+    #define next_row() if (++row >= screen_rows) return
+    auto &host = cache->host;
 
-                // If no existing job was found, assign a new one
-                if (!job) {
-                    for (auto j : cache->current_jobs) {
-                        if (j.second->host_slot == SIZE_MAX) {
-                            job = j.second;
-                            j.second->host_slot = i;
-                            break;
-                        }
-                    }
-                }
+    move(row, 0);
+    {
+        Attr color(COLOR_PAIR(host->highlighted ? highlight_color : expand_color));
+        addch(host->expanded ? '-' : '+');
+    }
 
-                if (job) {
-                    printw("(%5.1lfs) ", (double)((g_get_monotonic_time() - job->start_time) / 1000000.0));
-
-                    int color = 0;
-                    auto const h = job->getClient();
-                    if (h)
-                        color = h->getColor();
-
-                    Attr clr(COLOR_PAIR(color));
-                    if (job->filename.empty()) {
-                        addstr("<unknown>");
-                    } else if (get_anonymize()) {
-                        std::ostringstream ss;
-                        ss << "Job " << std::hash<std::string>{}(job->filename);
-                        addstr(ss.str().c_str());
-                    } else {
-                        addstr(job->filename.c_str());
-                    }
-                }
+    for (auto const &v: views) {
+        if (v.col + v.width <= layout.screen_cols)
+            v.column->output(row, v.col, v.width, cache);
+    }
+
+    if (host->expanded) {
+        for (size_t i = 0; i < host->getMaxJobs(); i++) {
+            next_row();
+            move(row, 2);
+            {
+                Attr bold(A_BOLD);
+                printw("Job %ld: ", i + 1);
             }
 
-            size_t width = 0;
-            for (auto const &a : host->attr) {
-                width = std::max(width, a.first.size());
+            auto const *job = host->getJobSlots().get(i);
+
+            if (job) {
+                printw("(%5.1lfs) ", (double)((g_get_monotonic_time() - job->start_time) / 1000000.0));
+
+                int color = 0;
+                auto const h = job->getClient();
+                if (h)
+                    color = h->getColor();
+
+                Attr clr(COLOR_PAIR(color));
+                if (job->file == PathStore::EMPTY) {
+                    addstr("<unknown>");
+                } else if (get_anonymize()) {
+                    std::ostringstream ss;
+                    ss << "Job " << std::hash<std::string>{}(job->getFilename());
+                    addstr(ss.str().c_str());
+                } else {
+                    addstr(job->getFilename().c_str());
+                }
             }
+        }
+
+        size_t width = 0;
+        for (auto const &a : host->attr) {
+            width = std::max(width, a.first.size());
+        }
 
-            for (auto const &a : host->attr) {
-                if (get_anonymize() && (a.first == "Name" || a.first == "IP"))
-                    continue;
+        for (auto const &a : host->attr) {
+            if (get_anonymize() && (a.first == "Name" || a.first == "IP"))
+                continue;
 
-                next_row();
-                move(row, 2);
-                {
-                    Attr bold(A_BOLD);
-                    addstr(a.first.c_str());
-                }
-                move(row, 2 + width + 1);
-                addstr(a.second.c_str());
+            next_row();
+            move(row, 2);
+            {
+                Attr bold(A_BOLD);
+                addstr(a.first.c_str());
             }
+            move(row, 2 + width + 1);
+            addstr(a.second.c_str());
         }
-        next_row();
     }
+    next_row();
+    #undef next_row
 }
 
 void NCursesInterface::doRedraw()
 {
-    erase();
     doRender();
     refresh();
+    dirty_hosts.clear();
+    model_changes.clear();
 }
 
 void NCursesInterface::triggerRedraw()
@@ -842,7 +1597,10 @@ void NCursesInterface::triggerRedraw()
 
 void NCursesInterface::init()
 {
-    initscr();
+    if (screen)
+        set_term(screen);
+    else
+        initscr();
 
     cbreak();
     use_default_colors();
@@ -853,6 +1611,8 @@ void NCursesInterface::init()
     nodelay(stdscr, TRUE);
     keypad(stdscr, TRUE);
 
+    full_repaint = true;
+
     Host::clearColors();
     Host::addColor(assign_color(COLOR_RED, -1));
     Host::addColor(assign_color(COLOR_YELLOW, -1));
@@ -872,30 +1632,55 @@ void NCursesInterface::init()
     triggerRedraw();
 }
 
-NCursesInterface::NCursesInterface() :
-    UserInterface()
+NCursesInterface::NCursesInterface(SCREEN *s, int fd) :
+    UserInterface(), screen(s), input_fd(fd)
 {
     init();
 
     columns.emplace_back(std::make_unique<IDColumn>(this));
+    if (scheduler && scheduler->getNetworkCount() > 1)
+        columns.emplace_back(std::make_unique<NetworkColumn>(this));
     columns.emplace_back(std::make_unique<NameColumn>(this));
     columns.emplace_back(std::make_unique<InJobsColumn>(this));
     columns.emplace_back(std::make_unique<CurrentJobsColumn>(this));
     columns.emplace_back(std::make_unique<MaxJobsColumn>(this));
     columns.emplace_back(std::make_unique<JobsColumn>(this));
+    columns.emplace_back(std::make_unique<UtilizationColumn>(this));
     columns.emplace_back(std::make_unique<OutJobsColumn>(this));
     columns.emplace_back(std::make_unique<LocalJobsColumn>(this));
     columns.emplace_back(std::make_unique<ActiveJobsColumn>(this));
     columns.emplace_back(std::make_unique<PendingJobsColumn>(this));
+    columns.emplace_back(std::make_unique<WaitColumn>(this, "P50", 0.50));
+    columns.emplace_back(std::make_unique<WaitColumn>(this, "P95", 0.95));
+    columns.emplace_back(std::make_unique<WaitColumn>(this, "P99", 0.99));
     columns.emplace_back(std::make_unique<SpeedColumn>(this));
+
+    for (size_t i = 0; i < columns.size(); i++)
+        columns[i]->setIndex(i);
 }
 
 NCursesInterface::~NCursesInterface()
 {
     endwin();
+    if (screen)
+        delscreen(screen);
 }
 
 std::unique_ptr<UserInterface> create_ncurses_interface()
 {
     return std::make_unique<NCursesInterface>();
 }
+
+std::unique_ptr<UserInterface> create_ncurses_interface(FILE *out, FILE *in)
+{
+    SCREEN *screen = newterm(nullptr, out, in);
+    if (!screen)
+        return nullptr;
+
+    return std::make_unique<NCursesInterface>(screen, fileno(in));
+}
+
+void print_job_graph(UserInterface const &interface, int max_jobs, int width, JobHistogram const &graph)
+{
+    static_cast<NCursesInterface const&>(interface).print_job_graph(max_jobs, width, graph);
+}
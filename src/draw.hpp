@@ -19,9 +19,20 @@
 
 #pragma once
 
+#include <cstdio>
 #include <memory>
 
 class UserInterface;
+class JobHistogram;
 
 std::unique_ptr<UserInterface> create_ncurses_interface();
 
+// Creates the interface on the terminal with the given output and input
+// instead of stdout and stdin, e.g. to render off-screen. The terminal type
+// is taken from $TERM. Returns nullptr if it is unknown
+std::unique_ptr<UserInterface> create_ncurses_interface(FILE *out, FILE *in);
+
+// Draws a job graph at the cursor, as the interface does in the host list.
+// interface must be an ncurses interface
+void print_job_graph(UserInterface const &interface, int max_jobs, int width, JobHistogram const &graph);
+
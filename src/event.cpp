@@ -0,0 +1,78 @@
+/*
+ * Command line Icecream status monitor
+ * Copyright (C) 2018-2020 by Garmin Ltd. or its subsidiaries.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "event.hpp"
+#include "main.hpp"
+
+void apply_monitor_event(MonitorEvent const &event)
+{
+    switch (event.type) {
+    case MonitorEvent::LOCAL_JOB_BEGIN:
+        Job::createLocal(event.job_id, event.hostid, event.text);
+        break;
+
+    case MonitorEvent::LOCAL_JOB_DONE:
+    case MonitorEvent::JOB_DONE:
+        Job::remove(event.job_id);
+        break;
+
+    case MonitorEvent::JOB_BEGIN:
+        Job::createRemote(event.job_id, event.hostid);
+        break;
+
+    case MonitorEvent::GET_CS:
+        Job::createPending(event.job_id, event.clientid, event.text);
+        break;
+
+    case MonitorEvent::STATS: {
+        auto host = Host::create(event.hostid);
+        bool alive = false;
+        bool changed = host->updateAttributes(event.text, alive);
+
+        if (!alive) {
+            Host::remove(event.hostid);
+        } else if (changed) {
+            model_changes.addHost(event.hostid);
+            model_changes.changed();
+        }
+        break;
+    }
+
+    case MonitorEvent::NONE:
+    case MonitorEvent::END:
+        break;
+    }
+}
+
+EventBatch::EventBatch(BatchLimits const &limits) :
+    m_limits(limits), m_start(g_get_monotonic_time())
+{
+}
+
+bool EventBatch::next()
+{
+    if (m_count && m_limits.max_events && m_count >= m_limits.max_events)
+        return false;
+
+    if (m_count && m_limits.max_time && g_get_monotonic_time() - m_start >= m_limits.max_time)
+        return false;
+
+    m_count++;
+    return true;
+}
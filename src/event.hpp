@@ -0,0 +1,83 @@
+/*
+ * Command line Icecream status monitor
+ * Copyright (C) 2018-2020 by Garmin Ltd. or its subsidiaries.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <glib.h>
+
+#include "main.hpp"
+
+// A decoded scheduler monitor message. This is independent of the icecc
+// message classes so that it can be passed between threads, recorded and
+// replayed
+struct MonitorEvent {
+    enum Type : uint8_t {
+        NONE,
+        LOCAL_JOB_BEGIN,
+        LOCAL_JOB_DONE,
+        JOB_BEGIN,
+        JOB_DONE,
+        GET_CS,
+        STATS,
+        END,
+    };
+
+    Type type = NONE;
+    uint32_t job_id = 0;
+    uint32_t hostid = 0;
+    uint32_t clientid = 0;
+    // Monotonic time (in microseconds) when the message was received
+    gint64 time = 0;
+    // File name for LOCAL_JOB_BEGIN and GET_CS, stats text for STATS
+    std::string text;
+};
+
+// Applies an event to the job and host model. END is not a model event and
+// must be handled by the caller
+void apply_monitor_event(MonitorEvent const &event);
+
+// Bounds the work done in one main loop iteration, so that a burst of events
+// does not starve input handling and redraws
+struct BatchLimits {
+    size_t max_events = 2000;
+    // Microseconds
+    gint64 max_time = 10000;
+};
+
+// Applies events as one model update: the user interface is signalled once
+// when the batch ends. Callers must reschedule whatever is left once next()
+// returns false.
+class EventBatch {
+public:
+    explicit EventBatch(BatchLimits const &limits);
+
+    // Returns true if another event fits in the budget, and counts it. The
+    // first event always fits
+    bool next();
+
+    size_t count() const { return m_count; }
+
+private:
+    ModelBatch m_batch;
+    BatchLimits m_limits;
+    gint64 m_start;
+    size_t m_count = 0;
+};
@@ -0,0 +1,501 @@
+/*
+ * Command line Icecream status monitor
+ * Copyright (C) 2018-2020 by Garmin Ltd. or its subsidiaries.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include <glib.h>
+
+#include "main.hpp"
+#include "json.hpp"
+
+// Microseconds between throughput reports
+#define STATS_INTERVAL (10 * 1000000)
+
+// Writes the model as newline delimited JSON. Every line is one object with
+// a "type":
+//
+//  snapshot    All hosts and jobs. Written first, and again whenever the
+//              model is rebuilt (e.g. after reconnecting to a scheduler)
+//  delta       The "events" since the previous line: host_up, host_changed,
+//              host_down, job_pending, job_start and job_end. Changes are
+//              coalesced over the interval, so a job that starts and ends
+//              between two lines is not reported
+//  stats       Throughput of the writer itself
+//
+// Lines are formatted into a reused buffer, so once it has grown to the size
+// of the largest line nothing is allocated while writing.
+class JsonInterface: public UserInterface {
+public:
+    JsonInterface(FILE *out, bool close_out, int interval);
+    virtual ~JsonInterface();
+
+    virtual void triggerRedraw() override;
+    virtual int processInput() override { return 0; }
+    virtual int getInputFd() override { return -1; }
+    virtual void suspend() override {}
+    virtual void resume() override {}
+
+    virtual void set_anonymize(bool a) override
+    {
+        anonymize = a;
+    }
+
+private:
+    static gboolean on_flush(gpointer user_data);
+
+    void flush();
+    void writeSnapshot(gint64 now);
+    void writeDelta(gint64 now);
+    void writeStats(gint64 now);
+    void output();
+
+    void appendHost(Host const &host, const char *event);
+    void appendJob(Job const &job, const char *event);
+    void appendString(StringRef s);
+    void appendNumber(uint64_t v);
+    void appendDouble(double v);
+    void appendBool(bool b);
+    void appendId(uint32_t id);
+
+    static const char *stateName(Job::State state);
+
+    FILE *out;
+    bool close_out;
+    int interval;
+    bool anonymize = false;
+    bool need_snapshot = true;
+    GlibSource flush_source;
+
+    std::string buffer;
+    std::string scratch;
+
+    // What the last line written said about the hosts and jobs, to tell
+    // what kind of change happened to them. Jobs map to their state + 1
+    FlatIdMap<bool> known_hosts;
+    FlatIdMap<uint8_t> known_jobs;
+
+    // Throughput. busy_us is the time spent formatting and writing
+    uint64_t lines = 0;
+    uint64_t records = 0;
+    uint64_t bytes = 0;
+    uint64_t busy_us = 0;
+    gint64 last_stats;
+};
+
+JsonInterface::JsonInterface(FILE *o, bool c, int i) :
+    UserInterface(), out(o), close_out(c), interval(i),
+    last_stats(g_get_monotonic_time())
+{
+    buffer.reserve(64 * 1024);
+
+    // The first snapshot
+    triggerRedraw();
+}
+
+JsonInterface::~JsonInterface()
+{
+    if (need_snapshot || !model_changes.empty())
+        flush();
+    writeStats(g_get_real_time());
+
+    if (close_out)
+        fclose(out);
+}
+
+void JsonInterface::triggerRedraw()
+{
+    if (flush_source.get())
+        return;
+
+    if (interval > 0)
+        flush_source.set(g_timeout_add(interval, on_flush, this));
+    else
+        flush_source.set(g_idle_add(on_flush, this));
+}
+
+gboolean JsonInterface::on_flush(gpointer user_data)
+{
+    auto *self = static_cast<JsonInterface*>(user_data);
+
+    self->flush_source.clear();
+    self->flush();
+    return FALSE;
+}
+
+void JsonInterface::flush()
+{
+    gint64 start = g_get_monotonic_time();
+    gint64 now = g_get_real_time();
+
+    if (need_snapshot || model_changes.getReset())
+        writeSnapshot(now);
+    else if (!model_changes.empty())
+        writeDelta(now);
+
+    need_snapshot = false;
+    model_changes.clear();
+
+    gint64 end = g_get_monotonic_time();
+    busy_us += end - start;
+
+    if (end - last_stats >= STATS_INTERVAL) {
+        writeStats(now);
+        last_stats = end;
+    }
+}
+
+void JsonInterface::writeSnapshot(gint64 now)
+{
+    known_hosts.clear();
+    known_jobs.clear();
+
+    buffer.append("{\"type\":\"snapshot\",\"time\":");
+    appendNumber(now);
+
+    if (scheduler) {
+        buffer.append(",\"scheduler\":");
+        appendString(scheduler->getSchedulerName());
+        buffer.append(",\"netname\":");
+        appendString(scheduler->getNetName());
+        buffer.append(",\"connected\":");
+        appendBool(scheduler->isConnected());
+    }
+
+    buffer.append(",\"hosts\":[");
+    bool first = true;
+    for (auto const &h : Host::hosts) {
+        if (!first)
+            buffer.push_back(',');
+        first = false;
+
+        appendHost(*h.second, nullptr);
+        known_hosts.set(h.first, true);
+        records++;
+    }
+
+    buffer.append("],\"jobs\":[");
+    first = true;
+    for (auto *list : { &Job::pendingJobs, &Job::localJobs, &Job::remoteJobs }) {
+        for (auto const *j : *list) {
+            if (!first)
+                buffer.push_back(',');
+            first = false;
+
+            appendJob(*j, nullptr);
+            known_jobs.set(j->id, j->state + 1);
+            records++;
+        }
+    }
+    buffer.append("]}\n");
+
+    output();
+}
+
+void JsonInterface::writeDelta(gint64 now)
+{
+    buffer.append("{\"type\":\"delta\",\"time\":");
+    appendNumber(now);
+    buffer.append(",\"events\":[");
+
+    size_t events = 0;
+    auto next_event = [&]() {
+        if (events++)
+            buffer.push_back(',');
+    };
+
+    model_changes.getHosts().forEach([&](uint32_t id, bool) {
+        auto host = Host::find(id);
+        bool known = known_hosts.find(id);
+
+        if (host) {
+            next_event();
+            appendHost(*host, known ? "host_changed" : "host_up");
+            known_hosts.set(id, true);
+        } else if (known) {
+            next_event();
+            buffer.append("{\"event\":\"host_down\",\"id\":");
+            appendNumber(id);
+            buffer.push_back('}');
+            known_hosts.erase(id);
+        }
+    });
+
+    model_changes.getJobs().forEach([&](uint32_t id, bool) {
+        auto const *job = Job::find(id);
+        auto const *known = known_jobs.find(id);
+
+        if (job) {
+            uint8_t state = job->state + 1;
+            if (known && *known == state)
+                return;
+
+            next_event();
+            appendJob(*job, job->isActive() ? "job_start" : "job_pending");
+            known_jobs.set(id, state);
+        } else if (known) {
+            next_event();
+            buffer.append("{\"event\":\"job_end\",\"id\":");
+            appendNumber(id);
+            buffer.append(",\"state\":\"");
+            buffer.append(stateName(static_cast<Job::State>(*known - 1)));
+            buffer.append("\"}");
+            known_jobs.erase(id);
+        }
+    });
+
+    buffer.append("]}\n");
+
+    // Everything may have cancelled out
+    if (!events) {
+        buffer.clear();
+        return;
+    }
+
+    records += events;
+    output();
+}
+
+void JsonInterface::writeStats(gint64 now)
+{
+    buffer.append("{\"type\":\"stats\",\"time\":");
+    appendNumber(now);
+    buffer.append(",\"lines\":");
+    appendNumber(lines);
+    buffer.append(",\"records\":");
+    appendNumber(records);
+    buffer.append(",\"bytes\":");
+    appendNumber(bytes);
+    buffer.append(",\"busy_us\":");
+    appendNumber(busy_us);
+    // How many records could be written per second if that was all the
+    // program did
+    buffer.append(",\"records_per_sec\":");
+    appendDouble(busy_us ? records * 1000000.0 / busy_us : 0);
+    buffer.append("}\n");
+
+    output();
+}
+
+void JsonInterface::output()
+{
+    if (fwrite(buffer.data(), 1, buffer.size(), out) != buffer.size() || fflush(out) != 0) {
+        std::cerr << "Unable to write JSON output: " << strerror(errno) << std::endl;
+        g_main_loop_quit(main_loop);
+    }
+
+    bytes += buffer.size();
+    lines++;
+    buffer.clear();
+}
+
+void JsonInterface::appendHost(Host const &host, const char *event)
+{
+    buffer.push_back('{');
+    if (event) {
+        buffer.append("\"event\":\"");
+        buffer.append(event);
+        buffer.append("\",");
+    }
+
+    buffer.append("\"id\":");
+    appendNumber(host.id);
+
+    buffer.append(",\"name\":");
+    if (anonymize) {
+        char name[32];
+        snprintf(name, sizeof(name), "Host %zx", host.getProfile().name_hash);
+        appendString(name);
+    } else {
+        appendString(host.getName());
+
+        auto const ip = host.attr.find("IP");
+        if (ip != host.attr.end()) {
+            buffer.append(",\"ip\":");
+            appendString(ip->second);
+        }
+    }
+
+    if (scheduler && scheduler->getNetworkCount() > 1 && host.getNetwork() < scheduler->getNetworkCount()) {
+        buffer.append(",\"network\":");
+        appendString(scheduler->getNetwork(host.getNetwork()).getNetName());
+    }
+
+    buffer.append(",\"platform\":");
+    appendString(host.getPlatform());
+    buffer.append(",\"max_jobs\":");
+    appendNumber(host.getMaxJobs());
+    buffer.append(",\"speed\":");
+    appendDouble(host.getSpeed());
+    buffer.append(",\"no_remote\":");
+    appendBool(host.getNoRemote());
+    buffer.append(",\"current\":");
+    appendNumber(host.getCurrentJobs().size());
+    buffer.append(",\"active\":");
+    appendNumber(host.getActiveJobs().size());
+    buffer.append(",\"pending\":");
+    appendNumber(host.getPendingJobs().size());
+    buffer.append(",\"in\":");
+    appendNumber(host.total_in);
+    buffer.append(",\"out\":");
+    appendNumber(host.total_out);
+    buffer.append(",\"local\":");
+    appendNumber(host.total_local);
+    buffer.push_back('}');
+}
+
+void JsonInterface::appendJob(Job const &job, const char *event)
+{
+    buffer.push_back('{');
+    if (event) {
+        buffer.append("\"event\":\"");
+        buffer.append(event);
+        buffer.append("\",");
+    }
+
+    buffer.append("\"id\":");
+    appendNumber(job.id);
+    buffer.append(",\"state\":\"");
+    buffer.append(stateName(job.state));
+    buffer.append("\",\"client\":");
+    appendId(job.clientid);
+    buffer.append(",\"host\":");
+    appendId(job.hostid);
+
+    buffer.append(",\"file\":");
+    if (job.file == PathStore::EMPTY) {
+        buffer.append("null");
+    } else {
+        scratch.clear();
+        Job::filenames.append(job.file, scratch);
+
+        if (anonymize) {
+            char name[32];
+            snprintf(name, sizeof(name), "Job %zu", std::hash<std::string>{}(scratch));
+            appendString(name);
+        } else {
+            appendString(scratch);
+        }
+    }
+    buffer.push_back('}');
+}
+
+void JsonInterface::appendString(StringRef s)
+{
+    buffer.push_back('"');
+    for (char c : s) {
+        switch (c) {
+        case '"':
+            buffer.append("\\\"");
+            break;
+        case '\\':
+            buffer.append("\\\\");
+            break;
+        case '\n':
+            buffer.append("\\n");
+            break;
+        case '\t':
+            buffer.append("\\t");
+            break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                char esc[8];
+                snprintf(esc, sizeof(esc), "\\u%04x", static_cast<unsigned>(c));
+                buffer.append(esc);
+            } else {
+                buffer.push_back(c);
+            }
+            break;
+        }
+    }
+    buffer.push_back('"');
+}
+
+void JsonInterface::appendNumber(uint64_t v)
+{
+    char digits[20];
+    size_t n = 0;
+
+    do {
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+
+    while (n)
+        buffer.push_back(digits[--n]);
+}
+
+void JsonInterface::appendDouble(double v)
+{
+    if (!std::isfinite(v)) {
+        buffer.append("null");
+        return;
+    }
+
+    // Not printf, which would use the locale's decimal separator
+    char str[G_ASCII_DTOSTR_BUF_SIZE];
+    buffer.append(g_ascii_formatd(str, sizeof(str), "%.6g", v));
+}
+
+void JsonInterface::appendBool(bool b)
+{
+    buffer.append(b ? "true" : "false");
+}
+
+// Host ids, where 0 means none
+void JsonInterface::appendId(uint32_t id)
+{
+    if (id)
+        appendNumber(id);
+    else
+        buffer.append("null");
+}
+
+const char *JsonInterface::stateName(Job::State state)
+{
+    switch (state) {
+    case Job::PENDING:
+        return "pending";
+    case Job::LOCAL:
+        return "local";
+    case Job::REMOTE:
+        return "remote";
+    }
+    return "unknown";
+}
+
+std::unique_ptr<UserInterface> create_json_interface(std::string const &path, int interval)
+{
+    if (path == "-")
+        return std::make_unique<JsonInterface>(stdout, false, interval);
+
+    FILE *out = fopen(path.c_str(), "w");
+    if (!out) {
+        std::cerr << "Unable to open " << path << ": " << strerror(errno) << std::endl;
+        return nullptr;
+    }
+
+    return std::make_unique<JsonInterface>(out, true, interval);
+}
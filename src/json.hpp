@@ -0,0 +1,31 @@
+/*
+ * Command line Icecream status monitor
+ * Copyright (C) 2018-2020 by Garmin Ltd. or its subsidiaries.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+class UserInterface;
+
+// Creates an interface that writes the state of the farm to path ("-" for
+// stdout) as newline delimited JSON: a snapshot whenever the model is
+// (re)built, then the changes since the last line every interval
+// milliseconds. Returns nullptr if path can't be opened
+std::unique_ptr<UserInterface> create_json_interface(std::string const &path, int interval);
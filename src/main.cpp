@@ -20,6 +20,8 @@
 #include "config.h"
 
 #include <cassert>
+#include <cstdlib>
+#include <initializer_list>
 #include <algorithm>
 #include <vector>
 #include <memory>
@@ -27,273 +29,53 @@
 #include <map>
 #include <glib.h>
 #include <glib-unix.h>
+#include <unistd.h>
 
 #include "main.hpp"
 #include "draw.hpp"
+#include "json.hpp"
+#include "metrics.hpp"
+#include "record.hpp"
+#include "replay.hpp"
 #include "scheduler.hpp"
 #include "simulator.hpp"
+#include "whatif.hpp"
 
-int total_remote_jobs = 0;
-int total_local_jobs = 0;
-GMainLoop *main_loop = nullptr;
-bool all_expanded = false;
-std::unique_ptr<Scheduler> scheduler;
-std::unique_ptr<UserInterface> interface;
-
-Job::Map Job::allJobs;
-Job::Map Job::pendingJobs;
-Job::Map Job::activeJobs;
-Job::Map Job::localJobs;
-Job::Map Job::remoteJobs;
-
-std::vector<int> Host::host_color_ids;
-int Host::localhost_color_id;
-std::map<uint32_t, std::shared_ptr<Host> > Host::hosts;
-
-static std::string schedname = std::string();
-static std::string netname = std::string();
+// (netname, schedname) of each network to monitor
+static std::vector<std::pair<std::string, std::string> > networks;
 static gboolean opt_simulate = FALSE;
 static gboolean opt_anonymize = FALSE;
+static gboolean opt_ingest_thread = FALSE;
 static gint opt_sim_seed = 12345;
 static gint opt_sim_cycles = -1;
 static gint opt_sim_speed = 20;
-
-std::shared_ptr<Job> Job::create(uint32_t id)
-{
-    class RealJob: public Job {
-    public:
-        explicit RealJob(uint32_t id): Job(id) {}
-        virtual ~RealJob() {}
-    };
-
-    auto job = find(id);
-
-    if (!job) {
-        job = std::make_shared<RealJob>(id);
-        allJobs[id] = job;
-    }
-
-    return job;
-}
-
-std::shared_ptr<Job> Job::find(uint32_t id)
-{
-    auto j = allJobs.find(id);
-
-    if (j != allJobs.end())
-        return j->second;
-    return nullptr;
-}
-
-void Job::remove(uint32_t id)
-{
-    removeTypes(id);
-    removeFromMap(allJobs, id);
-
-    if (interface)
-        interface->triggerRedraw();
-}
-
-void Job::removeFromMap(Map &map, uint32_t id)
-{
-    auto j = map.find(id);
-    if (j != map.end())
-        map.erase(j);
-}
-
-void Job::removeTypes(uint32_t id)
-{
-    removeFromMap(pendingJobs, id);
-    removeFromMap(activeJobs, id);
-    removeFromMap(localJobs, id);
-    removeFromMap(remoteJobs, id);
-}
-
-void Job::createLocal(uint32_t id, uint32_t hostid, std::string const& filename)
-{
-    auto job = Job::create(id);
-
-    job->active = true;
-    job->clientid = hostid;
-    job->hostid = hostid;
-    job->is_local = true;
-    job->filename = filename;
-    job->start_time = g_get_monotonic_time();
-
-    auto h = job->getClient();
-    if (h)
-        h->total_local++;
-    total_local_jobs++;
-
-    removeTypes(id);
-    localJobs[id] = job;
-    activeJobs[id] = job;
-
-    if (interface)
-        interface->triggerRedraw();
-}
-
-void Job::createPending(uint32_t id, uint32_t clientid, std::string const& filename)
-{
-    auto job = Job::create(id);
-
-    job->clientid = clientid;
-    job->filename = filename;
-
-    removeTypes(id);
-    pendingJobs[id] = job;
-
-    if (interface)
-        interface->triggerRedraw();
-}
-
-void Job::createRemote(uint32_t id, uint32_t hostid)
-{
-    auto job = Job::find(id);
-
-    if (!job)
-        return;
-
-    job->active = true;
-    job->hostid = hostid;
-    job->start_time = g_get_monotonic_time();
-
-    auto host = job->getHost();
-    if (host)
-        host->total_in++;
-
-    auto client = job->getClient();
-    if (client)
-        client->total_out++;
-    total_remote_jobs++;
-
-    removeTypes(id);
-    activeJobs[id] = job;
-    remoteJobs[id] = job;
-
-    if (interface)
-        interface->triggerRedraw();
-}
-
-void Job::clearAll()
-{
-    allJobs.clear();
-    pendingJobs.clear();
-    activeJobs.clear();
-    localJobs.clear();
-    remoteJobs.clear();
-}
-
-std::shared_ptr<Host> Job::getClient() const
-{
-    if (!clientid)
-        return nullptr;
-
-    return Host::find(clientid);
-}
-
-std::shared_ptr<Host> Job::getHost() const
-{
-    if (!hostid)
-        return nullptr;
-
-    return Host::find(hostid);
-}
-
-std::shared_ptr<Host> Host::create(uint32_t id)
-{
-    class RealHost: public Host {
-    public:
-        explicit RealHost(uint32_t id): Host(id) {}
-        virtual ~RealHost() {}
-    };
-
-    auto host = find(id);
-
-    if (!host) {
-        host = std::make_shared<RealHost>(id);
-        hosts[id] = host;
-    }
-
-    if (interface)
-        interface->triggerRedraw();
-    return host;
-}
-
-std::shared_ptr<Host> Host::find(uint32_t id)
-{
-    auto h = hosts.find(id);
-
-    if (h != hosts.end())
-        return h->second;
-
-    return nullptr;
-}
-
-void Host::remove(uint32_t id)
-{
-    auto h = hosts.find(id);
-
-    if (h != hosts.end()) {
-        hosts.erase(h);
-        if (interface)
-            interface->triggerRedraw();
-    }
-}
-
-Job::Map Host::getPendingJobs() const
-{
-    Job::Map map;
-
-    for (auto j : Job::pendingJobs) {
-        if (j.second->clientid == id)
-            map[j.first] = j.second;
-    }
-
-    return map;
-}
-
-Job::Map Host::getActiveJobs() const
-{
-    Job::Map map;
-
-    for (auto j : Job::activeJobs) {
-        if (j.second->clientid == id)
-            map[j.first] = j.second;
-    }
-
-    return map;
-}
-
-Job::Map Host::getCurrentJobs() const
-{
-    Job::Map map;
-
-    for (auto j : Job::activeJobs) {
-        if (j.second->hostid == id)
-            map[j.first] = j.second;
-    }
-
-    return map;
-}
-
-int Host::getColor() const
-{
-    char buffer[1024];
-
-    if (gethostname(buffer, sizeof(buffer)) == 0 ) {
-        buffer[sizeof(buffer) - 1] = '\0';
-        if (getName() == buffer)
-            return localhost_color_id;
-    }
-
-    return host_color_ids[hashName() % host_color_ids.size()];
-}
-
-size_t Host::hashName() const
-{
-    return std::hash<std::string>{}(getName());
-}
+static gboolean opt_sim_fast = FALSE;
+static gint opt_sim_hosts = 10;
+static gint opt_sim_min_host_jobs = 1;
+static gint opt_sim_max_host_jobs = 18;
+static gchar *opt_sim_profile = NULL;
+static gchar *opt_sim_weights = NULL;
+static gchar *opt_sim_farm = NULL;
+static gchar *opt_sim_placement = NULL;
+static SimulatorConfig sim_config;
+static gchar *opt_what_if = NULL;
+static gchar *opt_what_if_policy = NULL;
+static gdouble opt_what_if_time = 3600;
+static gdouble opt_what_if_rate = 20;
+static gdouble opt_what_if_job_time = 10;
+static WhatIfConfig what_if_config;
+static gint opt_history_size = 10000;
+static gint opt_batch_events = 2000;
+static gint opt_batch_time = 10;
+static gchar *opt_json = NULL;
+static gint opt_json_interval = 1000;
+static gchar *opt_metrics_address = NULL;
+static gint opt_metrics_port = 0;
+static gint opt_metrics_interval = 1000;
+static gchar *opt_record = NULL;
+static gchar *opt_replay = NULL;
+static gdouble opt_replay_speed = 1;
+static gboolean opt_replay_exit = FALSE;
 
 static bool parse_args(int *argc, char ***argv)
 {
@@ -306,19 +88,45 @@ static bool parse_args(int *argc, char ***argv)
         }
     };
 
-    static gchar *opt_scheduler = NULL;
-    static gchar *opt_netname = NULL;
+    static gchar **opt_scheduler = NULL;
+    static gchar **opt_netname = NULL;
     static gboolean opt_about = FALSE;
     static gboolean opt_version = FALSE;
 
     static const GOptionEntry opts[] =
     {
-        { "scheduler", 's', 0, G_OPTION_ARG_STRING, &opt_scheduler, "Icecream scheduler hostname", NULL },
-        { "netname", 'n', 0, G_OPTION_ARG_STRING, &opt_netname, "Icecream network name", NULL },
+        { "scheduler", 's', 0, G_OPTION_ARG_STRING_ARRAY, &opt_scheduler, "Icecream scheduler hostname. Repeat with --netname to monitor several networks", NULL },
+        { "netname", 'n', 0, G_OPTION_ARG_STRING_ARRAY, &opt_netname, "Icecream network name. Repeat to monitor several networks", NULL },
+        { "ingest-thread", 0, 0, G_OPTION_ARG_NONE, &opt_ingest_thread, "Read scheduler messages on a separate thread", NULL },
+        { "batch-events", 0, 0, G_OPTION_ARG_INT, &opt_batch_events, "Maximum scheduler messages to apply per main loop iteration. 0 for no limit (default 2000)", NULL },
+        { "batch-time", 0, 0, G_OPTION_ARG_INT, &opt_batch_time, "Maximum milliseconds to spend applying scheduler messages per main loop iteration. 0 for no limit (default 10)", NULL },
+        { "record", 0, 0, G_OPTION_ARG_FILENAME, &opt_record, "Record the scheduler messages to FILE", "FILE" },
+        { "replay", 0, 0, G_OPTION_ARG_FILENAME, &opt_replay, "Replay a recording instead of connecting to a scheduler", "FILE" },
+        { "replay-speed", 0, 0, G_OPTION_ARG_DOUBLE, &opt_replay_speed, "Replay speed, relative to the recording. 0 to replay as fast as possible (default 1)", NULL },
+        { "replay-exit", 0, 0, G_OPTION_ARG_NONE, &opt_replay_exit, "Exit when the replay is done", NULL },
         { "simulate", 0, 0, G_OPTION_ARG_NONE, &opt_simulate, "Simulate activity", NULL },
         { "sim-seed", 0, 0, G_OPTION_ARG_INT, &opt_sim_seed, "Simulator seed", NULL },
         { "sim-cycles", 0, 0, G_OPTION_ARG_INT, &opt_sim_cycles, "Number of simulator cycles to run. -1 for no limit", NULL },
         { "sim-speed", 0, 0, G_OPTION_ARG_INT, &opt_sim_speed, "Simulator speed (milliseconds between cycles)", NULL },
+        { "sim-fast", 0, 0, G_OPTION_ARG_NONE, &opt_sim_fast, "Run simulator cycles back to back instead of at --sim-speed", NULL },
+        { "sim-hosts", 0, 0, G_OPTION_ARG_INT, &opt_sim_hosts, "Number of simulated hosts (default 10)", NULL },
+        { "sim-min-host-jobs", 0, 0, G_OPTION_ARG_INT, &opt_sim_min_host_jobs, "Fewest jobs a simulated host can run (default 1)", NULL },
+        { "sim-max-host-jobs", 0, 0, G_OPTION_ARG_INT, &opt_sim_max_host_jobs, "Most jobs a simulated host can run (default 18)", NULL },
+        { "sim-profile", 0, 0, G_OPTION_ARG_STRING, &opt_sim_profile, "Simulated workload: steady (default), rebuild, link or churn", "NAME" },
+        { "sim-weights", 0, 0, G_OPTION_ARG_STRING, &opt_sim_weights, "Override simulator action weights, e.g. pending=10,host_down=1. Actions are pending, local, activate, remove, source, host_up and host_down", "LIST" },
+        { "sim-farm", 0, 0, G_OPTION_ARG_STRING, &opt_sim_farm, "Simulate these hosts instead, e.g. 20x8+4x16@150 for 20 hosts with 8 slots and 4 with 16 slots at speed 150", "SPEC" },
+        { "sim-placement", 0, 0, G_OPTION_ARG_STRING, &opt_sim_placement, "How simulated jobs are assigned to hosts: random (default), fastest or icecream", "NAME" },
+        { "what-if", 0, 0, G_OPTION_ARG_STRING, &opt_what_if, "Print how a farm would cope with a workload and exit. The farm is described as for --sim-farm; 'current' adds the hosts at the end of the --replay recording", "SPEC" },
+        { "what-if-policy", 0, 0, G_OPTION_ARG_STRING, &opt_what_if_policy, "Comma separated placement policies to compare (default all)", "LIST" },
+        { "what-if-time", 0, 0, G_OPTION_ARG_DOUBLE, &opt_what_if_time, "Seconds to simulate (default 3600)", NULL },
+        { "what-if-rate", 0, 0, G_OPTION_ARG_DOUBLE, &opt_what_if_rate, "Jobs submitted per second (default 20)", NULL },
+        { "what-if-job-time", 0, 0, G_OPTION_ARG_DOUBLE, &opt_what_if_job_time, "Average seconds a job takes at speed 100 (default 10)", NULL },
+        { "history", 0, 0, G_OPTION_ARG_INT, &opt_history_size, "Number of completed jobs to remember (default 10000)", NULL },
+        { "json", 0, 0, G_OPTION_ARG_FILENAME, &opt_json, "Write the farm state to FILE as newline delimited JSON instead of showing it. '-' for stdout", "FILE" },
+        { "json-interval", 0, 0, G_OPTION_ARG_INT, &opt_json_interval, "Milliseconds between JSON updates. 0 to write each change as soon as possible (default 1000)", NULL },
+        { "metrics-port", 0, 0, G_OPTION_ARG_INT, &opt_metrics_port, "Serve OpenMetrics on this port. 0 to disable (default)", NULL },
+        { "metrics-address", 0, 0, G_OPTION_ARG_STRING, &opt_metrics_address, "Address to serve OpenMetrics on (default 127.0.0.1)", NULL },
+        { "metrics-interval", 0, 0, G_OPTION_ARG_INT, &opt_metrics_interval, "Milliseconds between OpenMetrics updates (default 1000)", NULL },
         { "anonymize", 0, 0, G_OPTION_ARG_NONE, &opt_anonymize, "Anonymize hosts and files (for demos)", NULL },
         { "about", 0, 0, G_OPTION_ARG_NONE, &opt_about, "Show about", NULL },
         { "version", 0, 0, G_OPTION_ARG_NONE, &opt_version, "Show version", NULL },
@@ -336,11 +144,101 @@ static bool parse_args(int *argc, char ***argv)
         return false;
     }
 
-    if (opt_scheduler)
-        schedname = opt_scheduler;
+    // A single scheduler or netname goes with all the networks
+    guint num_schedulers = opt_scheduler ? g_strv_length(opt_scheduler) : 0;
+    guint num_netnames = opt_netname ? g_strv_length(opt_netname) : 0;
+
+    if (num_schedulers > 1 && num_netnames > 1 && num_schedulers != num_netnames) {
+        std::cout << "Give one --scheduler for each --netname" << std::endl;
+        return false;
+    }
+
+    for (guint i = 0; i < std::max(std::max(num_schedulers, num_netnames), 1u); i++) {
+        networks.emplace_back(
+                num_netnames ? opt_netname[std::min(i, num_netnames - 1)] : "",
+                num_schedulers ? opt_scheduler[std::min(i, num_schedulers - 1)] : "");
+    }
+
+    if (opt_simulate && opt_replay) {
+        std::cout << "--simulate and --replay can't be used together" << std::endl;
+        return false;
+    }
+
+    if (opt_sim_hosts < 0 || opt_sim_min_host_jobs < 0 || opt_sim_max_host_jobs < opt_sim_min_host_jobs) {
+        std::cout << "Invalid simulated farm size" << std::endl;
+        return false;
+    }
+
+    sim_config.seed = opt_sim_seed;
+    sim_config.cycles = opt_sim_cycles;
+    sim_config.speed = opt_sim_speed;
+    sim_config.fast = opt_sim_fast;
+    sim_config.hosts = opt_sim_hosts;
+    sim_config.min_host_jobs = opt_sim_min_host_jobs;
+    sim_config.max_host_jobs = opt_sim_max_host_jobs;
+
+    if (opt_sim_profile && !set_simulator_profile(sim_config, opt_sim_profile)) {
+        std::cout << "Unknown simulator profile " << opt_sim_profile << std::endl;
+        return false;
+    }
+
+    if (opt_sim_weights && !set_simulator_weights(sim_config, opt_sim_weights)) {
+        std::cout << "Invalid simulator weights " << opt_sim_weights << std::endl;
+        return false;
+    }
+
+    if (opt_sim_farm && (!parse_farm_spec(opt_sim_farm, sim_config.farm) || sim_config.farm.current)) {
+        std::cout << "Invalid simulator farm " << opt_sim_farm << std::endl;
+        return false;
+    }
+
+    if (opt_sim_placement) {
+        auto const &names = get_placement_policy_names();
+        if (std::find(names.begin(), names.end(), opt_sim_placement) == names.end()) {
+            std::cout << "Unknown placement policy " << opt_sim_placement << std::endl;
+            return false;
+        }
+        sim_config.placement = opt_sim_placement;
+    }
+
+    if (opt_what_if) {
+        if (!parse_farm_spec(opt_what_if, what_if_config.farm)) {
+            std::cout << "Invalid farm " << opt_what_if << std::endl;
+            return false;
+        }
+
+        if (what_if_config.farm.current && !opt_replay) {
+            std::cout << "The current farm comes from a --replay recording" << std::endl;
+            return false;
+        }
+
+        if (opt_what_if_time <= 0 || opt_what_if_rate <= 0 || opt_what_if_job_time <= 0) {
+            std::cout << "Invalid what-if workload" << std::endl;
+            return false;
+        }
+
+        if (opt_what_if_policy) {
+            gchar **names = g_strsplit(opt_what_if_policy, ",", -1);
+            for (gchar **n = names; *n; n++)
+                what_if_config.policies.push_back(*n);
+            g_strfreev(names);
+        }
+
+        what_if_config.duration = opt_what_if_time;
+        what_if_config.rate = opt_what_if_rate;
+        what_if_config.job_time = opt_what_if_job_time;
+        what_if_config.seed = opt_sim_seed;
+    }
+
+    if (opt_record && networks.size() > 1) {
+        std::cout << "--record can only record one network" << std::endl;
+        return false;
+    }
 
-    if (opt_netname)
-        netname = opt_netname;
+    if (opt_record && (opt_simulate || opt_replay)) {
+        std::cout << "--record needs a scheduler to record" << std::endl;
+        return false;
+    }
 
     if (opt_version) {
         std::cout << VERSION << std::endl;
@@ -386,26 +284,110 @@ static gboolean process_input(gint, GIOCondition, gpointer)
     return TRUE;
 }
 
+// Adds the hosts in the model to the what-if farm, ahead of the other groups
+static void add_current_hosts(FarmSpec &farm)
+{
+    std::vector<FarmSpec::Group> current;
+
+    for (auto const &h : Host::hosts) {
+        FarmSpec::Group group;
+        group.count = 1;
+        group.slots = h.second->getMaxJobs();
+        group.speed = h.second->getSpeed();
+        group.no_remote = h.second->getNoRemote();
+        current.push_back(group);
+    }
+
+    farm.groups.insert(farm.groups.begin(), current.begin(), current.end());
+}
+
+static gboolean on_sample_utilization(gpointer)
+{
+    Host::sampleUtilization();
+    return TRUE;
+}
+
 int main(int argc, char **argv)
 {
     setlocale(LC_ALL, "");
     if (!parse_args(&argc, &argv))
         return 1;
 
-    std::cout <<
+    // Keep stdout clean for the JSON and what-if output
+    std::ostream &banner = opt_json || opt_what_if ? std::cerr : std::cout;
+    banner <<
         "Command line Icecream status monitor, Version " << VERSION << std::endl <<
         "Copyright (C) 2018 by Garmin Ltd. or its subsidiaries." << std::endl <<
         "This is free software, and you are welcome to redistribute it" << std::endl <<
         "under certain conditions; run with '--about' for details." << std::endl;
 
 
+    std::unique_ptr<UserInterface> json_interface;
+    if (opt_json) {
+        json_interface = create_json_interface(opt_json, std::max(opt_json_interval, 0));
+        if (!json_interface)
+            return 1;
+    }
+
+    std::unique_ptr<MetricsExporter> metrics;
+    if (opt_metrics_port > 0) {
+        metrics = create_metrics_exporter(opt_metrics_address ? opt_metrics_address : "127.0.0.1",
+                opt_metrics_port, opt_metrics_interval, opt_anonymize);
+        if (!metrics)
+            return 1;
+    }
+
+    std::unique_ptr<EventRecorder> recorder;
+    if (opt_record) {
+        recorder = create_event_recorder(opt_record);
+        if (!recorder)
+            return 1;
+    }
+
+    std::unique_ptr<EventReader> replay;
+    if (opt_replay) {
+        replay = open_event_reader(opt_replay);
+        if (!replay)
+            return 1;
+    }
+
+    if (opt_what_if) {
+        if (what_if_config.farm.current) {
+            apply_recording(*replay);
+            add_current_hosts(what_if_config.farm);
+        }
+
+        bool ok = run_what_if(what_if_config, std::cout);
+
+        Job::clearAll();
+        Host::clearAll();
+        return ok ? 0 : 1;
+    }
+
     main_loop = g_main_loop_new(nullptr, false);
 
-    if (opt_simulate)
-        scheduler = create_simulator(opt_sim_seed, opt_sim_cycles, opt_sim_speed);
+    Job::history.setCapacity(std::max(opt_history_size, 0));
+
+    BatchLimits limits;
+    limits.max_events = std::max(opt_batch_events, 0);
+    limits.max_time = static_cast<gint64>(std::max(opt_batch_time, 0)) * 1000;
+
+    if (opt_simulate) {
+        scheduler = create_simulator(sim_config, limits);
+    } else if (replay) {
+        scheduler = create_replay(std::move(replay), opt_replay, std::max(opt_replay_speed, 0.0),
+                opt_replay_exit, limits);
+    } else if (networks.size() > 1) {
+        scheduler = connect_to_schedulers(networks, opt_ingest_thread, limits);
+    } else {
+        scheduler = connect_to_scheduler(networks[0].first, networks[0].second, opt_ingest_thread, limits,
+                std::move(recorder));
+    }
+
+    if (json_interface)
+        interface = std::move(json_interface);
     else
-        scheduler = connect_to_scheduler(netname, schedname);
-    interface = create_ncurses_interface();
+        interface = create_ncurses_interface();
     interface->set_anonymize(opt_anonymize);
 
     int input_fd = interface->getInputFd();
@@ -414,18 +396,20 @@ int main(int argc, char **argv)
     if (input_fd >= 0)
         input_source.set(g_unix_fd_add(input_fd, G_IO_IN, process_input, nullptr));
 
+    GlibSource utilization_source(g_timeout_add(UTILIZATION_INTERVAL_MS, on_sample_utilization, nullptr));
     GlibSource sigint_source(g_unix_signal_add(SIGINT, reinterpret_cast<GSourceFunc>(on_quit_signal), nullptr));
     GlibSource sigterm_source(g_unix_signal_add(SIGTERM, reinterpret_cast<GSourceFunc>(on_quit_signal), nullptr));
 
     g_main_loop_run(main_loop);
 
+    metrics.reset();
     scheduler.reset();
     interface.reset();
 
     g_main_loop_unref(main_loop);
 
     Job::clearAll();
-    Host::hosts.clear();
+    Host::clearAll();
 
     return 0;
 }
@@ -19,6 +19,8 @@
 
 #pragma once
 
+#include <algorithm>
+#include <cassert>
 #include <cstdint>
 #include <map>
 #include <memory>
@@ -27,56 +29,216 @@
 #include <sstream>
 #include <glib.h>
 
+#include "containers.hpp"
+#include "pathstore.hpp"
+#include "strref.hpp"
+
 extern bool all_expanded;
 
 struct Host;
 
-struct Job {
-    typedef std::map<uint32_t, std::shared_ptr<Job> > Map;
-    typedef std::vector<std::shared_ptr<Job> > List;
+// Compact record of a job that has finished
+struct JobRecord {
+    uint32_t id = 0;
+    uint32_t clientid = 0;
+    uint32_t hostid = 0;
+    PathStore::Handle file = PathStore::EMPTY;
+    guint64 start_time = 0;
+    guint64 end_time = 0;
+    bool is_local = false;
+};
+
+// Number of active jobs by client color and local/remote, which is all that
+// is needed to draw a job graph. Bins are kept in display order: local jobs
+// first, then by color.
+class JobHistogram {
+public:
+    struct Bin {
+        int color;
+        bool is_local;
+        int count;
+    };
+
+    void add(int color, bool is_local)
+    {
+        auto i = lower(color, is_local);
+        if (i != m_bins.end() && i->color == color && i->is_local == is_local)
+            i->count++;
+        else
+            m_bins.insert(i, Bin{color, is_local, 1});
+        m_total++;
+    }
+
+    void remove(int color, bool is_local)
+    {
+        auto i = lower(color, is_local);
+        assert(i != m_bins.end() && i->color == color && i->is_local == is_local);
+
+        if (--i->count == 0)
+            m_bins.erase(i);
+        m_total--;
+    }
 
-    virtual ~Job() {}
+    std::vector<Bin> const &getBins() const { return m_bins; }
+    int total() const { return m_total; }
+
+    void clear()
+    {
+        m_bins.clear();
+        m_total = 0;
+    }
+
+private:
+    // Returns the first bin that doesn't come before (color, is_local)
+    std::vector<Bin>::iterator lower(int color, bool is_local)
+    {
+        return std::find_if(m_bins.begin(), m_bins.end(), [&](Bin const &b) {
+            if (b.is_local != is_local)
+                return !b.is_local;
+            return b.color >= color;
+        });
+    }
+
+    std::vector<Bin> m_bins;
+    int m_total = 0;
+};
+
+// Microseconds that jobs waited for a compile server, to within 1/8, up to
+// about 19 hours
+typedef LogHistogram<3, 36> WaitHistogram;
+
+struct JobStateTag;
+struct JobClientTag;
+struct JobServerTag;
+
+// Jobs live in a pooled table and are linked into intrusive lists: one for
+// their state, one on their client host and one on the host compiling them.
+// Job pointers stay valid until the job is removed.
+struct Job: public ListHook<Job, JobStateTag>,
+            public ListHook<Job, JobClientTag>,
+            public ListHook<Job, JobServerTag> {
+    enum State : uint8_t {
+        PENDING,
+        LOCAL,
+        REMOTE,
+    };
+
+    // All jobs in one state
+    typedef IntrusiveList<Job, JobStateTag> StateList;
+    // Pending or active jobs submitted by a host
+    typedef IntrusiveList<Job, JobClientTag> ClientList;
+    // Jobs being compiled by a host
+    typedef IntrusiveList<Job, JobServerTag> ServerList;
 
     const uint32_t id;
+    State state = PENDING;
+    bool is_local = false;
     uint32_t clientid = 0;
     uint32_t hostid = 0;
-    bool active = false;
-    bool is_local = false;
-    std::string filename;
+    PathStore::Handle file = PathStore::EMPTY;
+    // Slot on the compiling host, for the expanded view. Only valid while
+    // the job is in the host's current jobs
     size_t host_slot = SIZE_MAX;
     guint64 start_time = 0;
+    // When the job was submitted, if it was seen pending
+    guint64 pending_time = 0;
+    // Color of the client, for job graphs. Only valid while active
+    int color = 0;
+
+    bool isActive() const
+    {
+        return state != PENDING;
+    }
+
+    std::string getFilename() const
+    {
+        return filenames.str(file);
+    }
 
     std::shared_ptr<Host> getClient() const;
     std::shared_ptr<Host> getHost() const;
 
-    static std::shared_ptr<Job> find(uint32_t id);
+    static Job *find(uint32_t id);
     static void remove(uint32_t id);
 
-    static void createLocal(uint32_t id, uint32_t hostid, std::string const& filename);
-    static void createPending(uint32_t id, uint32_t clientid, std::string const& filename);
+    static void createLocal(uint32_t id, uint32_t hostid, StringRef filename);
+    static void createPending(uint32_t id, uint32_t clientid, StringRef filename);
     static void createRemote(uint32_t id, uint32_t hostid);
     static void clearAll();
 
-    static Map allJobs;
-    static Map pendingJobs;
-    static Map activeJobs;
-    static Map localJobs;
-    static Map remoteJobs;
+    // Updates the graph color of an active job after its client's color
+    // changed
+    static void updateColor(Job *job);
 
-protected:
-    explicit Job(uint32_t jobid) : id(jobid) {}
+    static size_t count()
+    {
+        return table.size();
+    }
+
+    static size_t activeCount()
+    {
+        return localJobs.size() + remoteJobs.size();
+    }
+
+    static StateList pendingJobs;
+    static StateList localJobs;
+    static StateList remoteJobs;
+
+    // Active jobs of the whole farm
+    static JobHistogram graph;
+
+    // Time pending jobs of the whole farm waited before they became remote
+    static WaitHistogram wait_times;
+
+    // Interned file names of all jobs
+    static PathStore filenames;
+
+    // The most recently completed jobs. Jobs that finish without ever
+    // becoming active are not recorded
+    static RingBuffer<JobRecord> history;
 
 private:
-    static std::shared_ptr<Job> create(uint32_t id);
-    static void removeFromMap(Map &map, uint32_t id);
-    static void removeTypes(uint32_t id);
+    friend class ObjectPool<Job>;
+
+    explicit Job(uint32_t jobid) : id(jobid) {}
+
+    static Job *create(uint32_t id);
+    static void setState(Job *job, State state);
+
+    // Maintains the per-host job indexes of the job's client and host
+    static void index(Job *job);
+    static void touch(Job *job);
+    static void unindex(Job *job);
+
+    static ObjectPool<Job> pool;
+    static FlatIdMap<Job*> table;
+};
+
+// Typed copy of the host attributes that are needed for rendering and
+// sorting. It is parsed once each time the attributes change so that hot
+// paths never have to look up or convert the raw strings.
+struct HostProfile {
+    std::string name;
+    std::string platform;
+    size_t max_jobs = 0;
+    double speed = 0;
+    bool no_remote = false;
+    bool is_localhost = false;
+    size_t name_hash = 0;
 };
 
+// Interval between the samples of the busy slots of the hosts
+#define UTILIZATION_INTERVAL_MS (1000)
+
+// Busy slots are sampled in units of 1/UTILIZATION_SCALE of a slot, so that
+// averages keep some precision in integer samples
+#define UTILIZATION_SCALE (16)
+
 struct Host {
     typedef std::map<uint32_t, std::shared_ptr<Host> > Map;
     typedef std::vector<std::shared_ptr<Host> > List;
 
-    typedef std::map<std::string, std::string> Attributes;
+    typedef std::map<std::string, std::string, std::less<> > Attributes;
 
     virtual ~Host() {}
 
@@ -84,35 +246,77 @@ struct Host {
     Attributes attr;
     bool expanded;
     bool highlighted = false;
-    size_t current_position = 0;
     int total_out = 0;
     int total_in = 0;
     int total_local = 0;
 
-    Job::Map getPendingJobs() const;
-    Job::Map getActiveJobs() const;
-    Job::Map getCurrentJobs() const;
+    // Jobs this host has submitted that are waiting for a compile server
+    Job::ClientList const &getPendingJobs() const { return pending_jobs; }
+
+    // Jobs this host has submitted that are being compiled
+    Job::ClientList const &getActiveJobs() const { return active_jobs; }
+
+    // Jobs this host is compiling
+    Job::ServerList const &getCurrentJobs() const { return current_jobs; }
+    JobHistogram const &getJobGraph() const { return job_graph; }
+
+    // Current jobs by their slot number. A job keeps its slot from when it
+    // becomes active until it is done
+    SlotTable<Job> const &getJobSlots() const { return job_slots; }
+
+    // Time the pending jobs of this host waited before they became remote
+    WaitHistogram const &getWaitTimes() const { return wait_times; }
+
+    // History of the busy slots of the host, see sampleUtilization()
+    RollupSeries<uint16_t> const &getUtilization() const { return utilization; }
+
+    // Re-parses the profile from attr. Must be called after attr is changed
+    void updateProfile();
 
-    std::string getName() const
+    // Merges a MON_STATS text ("Key:Value" lines) into attr, only writing
+    // the values that differ. Returns true if anything changed. alive is set
+    // if the stats contain a Name, which is how the scheduler reports that
+    // the host is still present.
+    bool updateAttributes(StringRef stats, bool &alive);
+
+    HostProfile const &getProfile() const
+    {
+        return profile;
+    }
+
+    std::string const &getName() const
     {
-        return getStringAttr("Name");
+        return profile.name;
     }
 
     size_t getMaxJobs() const
     {
-        return getNumberAttr<size_t>("MaxJobs");
+        return profile.max_jobs;
     }
 
     double getSpeed() const
     {
-        return getNumberAttr<double>("Speed");
+        return profile.speed;
     }
 
     bool getNoRemote() const
     {
-        return getBoolAttr("NoRemote");
+        return profile.no_remote;
+    }
+
+    std::string const &getPlatform() const
+    {
+        return profile.platform;
+    }
+
+    // Index of the network the host is in, see Scheduler::getNetwork()
+    size_t getNetwork() const
+    {
+        return network;
     }
 
+    void setNetwork(size_t index);
+
     int getColor() const;
 
     static void addColor(int ident)
@@ -135,45 +339,91 @@ struct Host {
     static void remove(uint32_t id);
     static Map hosts;
 
+    // Removes all hosts. hosts must not be cleared directly, since that
+    // would leave the totals behind
+    static void clearAll();
+
+    // Totals over all the known hosts. They are kept up to date as hosts
+    // and jobs come and go, so that they don't have to be counted again
+    // for every frame
+    struct Totals {
+        // Hosts that accept remote jobs, and their job slots
+        size_t available = 0;
+        size_t slots = 0;
+        // Hosts that are compiling at least one job
+        size_t busy = 0;
+        // Hosts and the jobs they are compiling, by network index
+        std::vector<size_t> network_hosts;
+        std::vector<size_t> network_jobs;
+    };
+
+    static Totals const &getTotals()
+    {
+        return totals;
+    }
+
+    // Adds a sample of the busy slots of every host and of the whole farm
+    // to their utilization series. The first level of the series has a
+    // sample every UTILIZATION_INTERVAL_MS, the second one every 10 and the
+    // third one every 60 of those, each for a fixed number of samples
+    static void sampleUtilization();
+
+    // Seconds covered by each sample of a level of the utilization series
+    static unsigned getUtilizationInterval(size_t level);
+
+    // Busy slots of the whole farm
+    static RollupSeries<uint32_t> farm_utilization;
+
 protected:
     explicit Host(uint32_t hostid) : id(hostid), expanded(all_expanded)
         {}
 private:
-    std::string getStringAttr(std::string const &name, std::string const &dflt = "") const
-    {
-        auto const i = attr.find(name);
-        if (i == attr.end())
-            return dflt;
-        return i->second;
-    }
+    friend struct Job;
 
-    template <typename T>
-    T getNumberAttr(std::string const &name, T dflt = 0) const
-    {
-        auto const i = attr.find(name);
-        if (i == attr.end())
-            return dflt;
+    Job::ClientList pending_jobs;
+    Job::ClientList active_jobs;
+    Job::ServerList current_jobs;
+    JobHistogram job_graph;
+    SlotTable<Job> job_slots;
+    RollupSeries<uint16_t> utilization;
+    WaitHistogram wait_times;
 
-        T val;
-        std::istringstream(i->second) >> val;
-        return val;
-    }
+    HostProfile profile;
+    size_t network = 0;
+    // Set while the host is in hosts and counted in the totals
+    bool listed = false;
 
-    bool getBoolAttr(std::string const &name, bool dflt = false) const
-    {
-        auto const i = attr.find(name);
-        if (i == attr.end())
-            return dflt;
+    // Adds the host to the totals, or takes it out of them. Anything the
+    // totals depend on must only be changed between the two
+    void account(bool add);
 
-        bool val;
-        std::istringstream(i->second) >> std::boolalpha >> val;
-        return val;
-    }
+    std::string getStringAttr(std::string const &name, std::string const &dflt = "") const;
+    size_t getSizeAttr(std::string const &name, size_t dflt = 0) const;
+    double getDoubleAttr(std::string const &name, double dflt = 0) const;
+    bool getBoolAttr(std::string const &name, bool dflt = false) const;
 
-    size_t hashName() const;
+    static std::string const &getLocalHostname();
 
     static std::vector<int> host_color_ids;
     static int localhost_color_id;
+    static Totals totals;
+};
+
+// Statistics about how scheduler messages are being received
+struct IngestStats {
+    bool threaded = false;
+    size_t queue_depth = 0;
+    size_t queue_max_depth = 0;
+    size_t queue_capacity = 0;
+    uint64_t events = 0;
+    // Events that were still queued when a connection was closed
+    uint64_t dropped = 0;
+    // Times the ingest thread had to wait for room in the queue, and the
+    // total time it waited
+    uint64_t stalls = 0;
+    uint64_t blocked_us = 0;
+    // Events applied to the model, with or without the ingest thread
+    uint64_t applied = 0;
 };
 
 class Scheduler {
@@ -185,6 +435,24 @@ public:
 
     virtual std::string getNetName() const = 0;
     virtual std::string getSchedulerName() const = 0;
+
+    virtual IngestStats getIngestStats() const
+    {
+        return IngestStats();
+    }
+
+    // False while the connection is being (re)established. The model then
+    // holds the last known state, which may be stale
+    virtual bool isConnected() const { return true; }
+
+    // Microseconds it took to find and log in to the current scheduler, or 0
+    // if not known
+    virtual gint64 getConnectLatency() const { return 0; }
+
+    // The networks monitored. A scheduler only has more than one if it
+    // combines several
+    virtual size_t getNetworkCount() const { return 1; }
+    virtual Scheduler const &getNetwork(size_t) const { return *this; }
 };
 
 class UserInterface {
@@ -237,6 +505,82 @@ private:
     guint m_source;
 };
 
+// Records what changed in the model since the user interface last rendered
+// it. Model updates mark what they touch and call changed(), which signals
+// the user interface right away unless a batch is open, in which case it is
+// signalled once when the outermost batch ends.
+class ChangeSet {
+public:
+    void addHost(uint32_t id)
+    {
+        if (id)
+            m_hosts.set(id, true);
+    }
+
+    void addJob(uint32_t id)
+    {
+        if (id)
+            m_jobs.set(id, true);
+    }
+
+    // Hosts were added or removed
+    void setLayoutChanged() { m_layout = true; }
+
+    // The whole model was thrown away and is being rebuilt, e.g. after
+    // connecting to a scheduler. Individual changes are not recorded for it
+    void setReset()
+    {
+        m_reset = true;
+        m_layout = true;
+    }
+
+    FlatIdMap<bool> const &getHosts() const { return m_hosts; }
+    FlatIdMap<bool> const &getJobs() const { return m_jobs; }
+    bool getLayoutChanged() const { return m_layout; }
+    bool getReset() const { return m_reset; }
+
+    bool empty() const
+    {
+        return m_hosts.empty() && m_jobs.empty() && !m_layout && !m_reset;
+    }
+
+    // Called by the user interface once it has caught up. The sets shrink
+    // back after a burst of changes, so later frames only pay for the
+    // changes they have
+    void clear()
+    {
+        m_hosts.clear();
+        m_jobs.clear();
+        m_layout = false;
+        m_reset = false;
+    }
+
+    void changed();
+    void beginBatch() { m_batch_depth++; }
+    void endBatch();
+
+private:
+    FlatIdMap<bool> m_hosts;
+    FlatIdMap<bool> m_jobs;
+    bool m_layout = false;
+    bool m_reset = false;
+    bool m_pending = false;
+    unsigned m_batch_depth = 0;
+};
+
+extern ChangeSet model_changes;
+
+// Groups model updates so that the user interface is signalled once for all
+// of them
+class ModelBatch {
+public:
+    ModelBatch() { model_changes.beginBatch(); }
+    ~ModelBatch() { model_changes.endBatch(); }
+
+    ModelBatch(ModelBatch const &) = delete;
+    ModelBatch &operator=(ModelBatch const &) = delete;
+};
+
 extern GMainLoop *main_loop;
 extern int total_remote_jobs;
 extern int total_local_jobs;
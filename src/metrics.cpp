@@ -0,0 +1,511 @@
+/*
+ * Command line Icecream status monitor
+ * Copyright (C) 2018-2020 by Garmin Ltd. or its subsidiaries.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+
+#include <glib.h>
+#include <glib-unix.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "main.hpp"
+#include "metrics.hpp"
+
+// Connections beyond this are closed right away
+#define METRICS_MAX_CLIENTS (64)
+// Clients that take longer than this to send a request and read the answer
+// are dropped
+#define METRICS_CLIENT_TIMEOUT_MS (10000)
+// Longest request that is accepted
+#define METRICS_MAX_REQUEST (8192)
+
+#define CONTENT_TYPE "application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+class OpenMetricsExporter: public MetricsExporter {
+public:
+    OpenMetricsExporter(int fd, int interval, bool anonymize);
+    virtual ~OpenMetricsExporter();
+
+private:
+    // An HTTP connection. It reads one request, writes the answer and is
+    // closed
+    struct Client {
+        OpenMetricsExporter *exporter;
+        int fd;
+        GlibSource source;
+        GlibSource timeout_source;
+        std::string request;
+        // The answer. The body is shared with the exporter, so a refresh
+        // while it is being sent doesn't disturb it
+        std::string header;
+        std::shared_ptr<const std::string> body;
+        size_t sent = 0;
+
+        Client(OpenMetricsExporter *e, int f) : exporter(e), fd(f) {}
+        ~Client();
+    };
+
+    static gboolean on_accept(gint fd, GIOCondition condition, gpointer user_data);
+    static gboolean on_client_read(gint fd, GIOCondition condition, gpointer user_data);
+    static gboolean on_client_write(gint fd, GIOCondition condition, gpointer user_data);
+    static gboolean on_client_timeout(gpointer user_data);
+    static gboolean on_refresh(gpointer user_data);
+
+    void refresh();
+    void respond(Client *client);
+    bool send(Client *client);
+    void close(Client *client);
+
+    void appendHostLabels(std::string &out, Host const &host) const;
+
+    int listen_fd;
+    bool anonymize;
+    GlibSource listen_source;
+    GlibSource refresh_source;
+    std::map<int, std::unique_ptr<Client> > clients;
+
+    std::shared_ptr<const std::string> page;
+
+    uint64_t last_applied = 0;
+    gint64 last_refresh = 0;
+};
+
+OpenMetricsExporter::Client::~Client()
+{
+    ::close(fd);
+}
+
+OpenMetricsExporter::OpenMetricsExporter(int fd, int interval, bool a) :
+    MetricsExporter(), listen_fd(fd), anonymize(a)
+{
+    refresh();
+
+    listen_source.set(g_unix_fd_add(listen_fd, G_IO_IN, on_accept, this));
+    refresh_source.set(g_timeout_add(std::max(interval, 1), on_refresh, this));
+}
+
+OpenMetricsExporter::~OpenMetricsExporter()
+{
+    clients.clear();
+    listen_source.remove();
+    ::close(listen_fd);
+}
+
+gboolean OpenMetricsExporter::on_refresh(gpointer user_data)
+{
+    static_cast<OpenMetricsExporter*>(user_data)->refresh();
+    return TRUE;
+}
+
+gboolean OpenMetricsExporter::on_accept(gint, GIOCondition, gpointer user_data)
+{
+    auto *self = static_cast<OpenMetricsExporter*>(user_data);
+
+    for (;;) {
+        int fd = accept4(self->listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+            break;
+
+        if (self->clients.size() >= METRICS_MAX_CLIENTS) {
+            ::close(fd);
+            continue;
+        }
+
+        auto client = std::make_unique<Client>(self, fd);
+        client->source.set(g_unix_fd_add(fd, G_IO_IN, on_client_read, client.get()));
+        client->timeout_source.set(g_timeout_add(METRICS_CLIENT_TIMEOUT_MS, on_client_timeout, client.get()));
+        self->clients[fd] = std::move(client);
+    }
+
+    return TRUE;
+}
+
+gboolean OpenMetricsExporter::on_client_read(gint fd, GIOCondition, gpointer user_data)
+{
+    auto *client = static_cast<Client*>(user_data);
+    char buffer[1024];
+
+    for (;;) {
+        ssize_t len = read(fd, buffer, sizeof(buffer));
+        if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return TRUE;
+
+        if (len <= 0 || client->request.size() + len > METRICS_MAX_REQUEST) {
+            client->exporter->close(client);
+            return FALSE;
+        }
+
+        client->request.append(buffer, len);
+        if (client->request.find("\r\n\r\n") != std::string::npos ||
+                client->request.find("\n\n") != std::string::npos)
+            break;
+    }
+
+    client->exporter->respond(client);
+    return FALSE;
+}
+
+gboolean OpenMetricsExporter::on_client_write(gint, GIOCondition, gpointer user_data)
+{
+    auto *client = static_cast<Client*>(user_data);
+
+    if (client->exporter->send(client))
+        return TRUE;
+    return FALSE;
+}
+
+gboolean OpenMetricsExporter::on_client_timeout(gpointer user_data)
+{
+    auto *client = static_cast<Client*>(user_data);
+
+    client->timeout_source.clear();
+    client->exporter->close(client);
+    return FALSE;
+}
+
+// Picks the answer for the request and starts sending it. The read source
+// is done either way
+void OpenMetricsExporter::respond(Client *client)
+{
+    client->source.clear();
+
+    StringRef request(client->request);
+    StringRef method = request.split(' ');
+    StringRef path = request.split(' ');
+
+    // Query strings are ignored
+    path = path.split('?');
+
+    const char *status;
+    const char *type = CONTENT_TYPE;
+
+    if (method != "GET" && method != "HEAD") {
+        status = "405 Method Not Allowed";
+        type = "text/plain";
+        client->body = std::make_shared<const std::string>("Method Not Allowed\n");
+    } else if (path != "/metrics" && path != "/") {
+        status = "404 Not Found";
+        type = "text/plain";
+        client->body = std::make_shared<const std::string>("Not Found\n");
+    } else {
+        status = "200 OK";
+        client->body = page;
+    }
+
+    client->header = "HTTP/1.1 ";
+    client->header += status;
+    client->header += "\r\nContent-Type: ";
+    client->header += type;
+    client->header += "\r\nContent-Length: ";
+    client->header += std::to_string(client->body->size());
+    client->header += "\r\nConnection: close\r\n\r\n";
+
+    if (method == "HEAD")
+        client->body.reset();
+
+    if (send(client))
+        client->source.set(g_unix_fd_add(client->fd, G_IO_OUT, on_client_write, client));
+}
+
+// Sends as much of the answer as the socket takes. Returns true if there is
+// more to send; otherwise the client is closed
+bool OpenMetricsExporter::send(Client *client)
+{
+    size_t body_size = client->body ? client->body->size() : 0;
+
+    while (client->sent < client->header.size() + body_size) {
+        char const *data;
+        size_t len;
+
+        if (client->sent < client->header.size()) {
+            data = client->header.data() + client->sent;
+            len = client->header.size() - client->sent;
+        } else {
+            data = client->body->data() + client->sent - client->header.size();
+            len = client->header.size() + body_size - client->sent;
+        }
+
+        ssize_t ret = ::send(client->fd, data, len, MSG_NOSIGNAL);
+        if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return true;
+
+        if (ret <= 0)
+            break;
+
+        client->sent += ret;
+    }
+
+    close(client);
+    return false;
+}
+
+void OpenMetricsExporter::close(Client *client)
+{
+    // The client's sources may be the one being dispatched. Callers return
+    // FALSE, so it is fine to remove them here
+    clients.erase(client->fd);
+}
+
+// Label values may contain anything except that \, " and newlines must be
+// escaped
+static void append_label_value(std::string &out, StringRef value)
+{
+    out.push_back('"');
+    for (char c : value) {
+        switch (c) {
+        case '\\':
+            out.append("\\\\");
+            break;
+        case '"':
+            out.append("\\\"");
+            break;
+        case '\n':
+            out.append("\\n");
+            break;
+        default:
+            out.push_back(c);
+            break;
+        }
+    }
+    out.push_back('"');
+}
+
+static void append_metadata(std::string &out, const char *name, const char *type, const char *help)
+{
+    out += "# TYPE ";
+    out += name;
+    out += ' ';
+    out += type;
+    out += "\n# HELP ";
+    out += name;
+    out += ' ';
+    out += help;
+    out += '\n';
+}
+
+static void append_value(std::string &out, double value)
+{
+    char str[G_ASCII_DTOSTR_BUF_SIZE];
+
+    out += ' ';
+    if (std::isnan(value))
+        out += "NaN";
+    else if (std::isinf(value))
+        out += value > 0 ? "+Inf" : "-Inf";
+    else
+        out += g_ascii_dtostr(str, sizeof(str), value);
+    out += '\n';
+}
+
+void OpenMetricsExporter::appendHostLabels(std::string &out, Host const &host) const
+{
+    out += "{id=\"";
+    out += std::to_string(host.id);
+    out += "\",name=";
+
+    if (anonymize) {
+        char name[32];
+        snprintf(name, sizeof(name), "Host %zx", host.getProfile().name_hash);
+        append_label_value(out, name);
+    } else {
+        append_label_value(out, host.getName());
+    }
+    out += '}';
+}
+
+// Rebuilds the page. Each metric family has to be written in one block, so
+// the hosts are walked once per per-host metric
+void OpenMetricsExporter::refresh()
+{
+    struct HostMetric {
+        const char *name;
+        const char *type;
+        const char *help;
+        double (*value)(Host const &);
+    };
+
+    static const HostMetric host_metrics[] = {
+        { "icecream_host_current_jobs", "gauge", "Jobs the host is compiling",
+            [](Host const &h) -> double { return h.getCurrentJobs().size(); } },
+        { "icecream_host_max_jobs", "gauge", "Jobs the host can compile at once",
+            [](Host const &h) -> double { return h.getMaxJobs(); } },
+        { "icecream_host_pending_jobs", "gauge", "Jobs from the host waiting for a compile host",
+            [](Host const &h) -> double { return h.getPendingJobs().size(); } },
+        { "icecream_host_active_jobs", "gauge", "Jobs from the host being compiled",
+            [](Host const &h) -> double { return h.getActiveJobs().size(); } },
+        { "icecream_host_in_jobs", "counter", "Jobs the host has compiled for other hosts",
+            [](Host const &h) -> double { return h.total_in; } },
+        { "icecream_host_out_jobs", "counter", "Jobs the host has sent to other hosts",
+            [](Host const &h) -> double { return h.total_out; } },
+        { "icecream_host_local_jobs", "counter", "Jobs the host has compiled for itself",
+            [](Host const &h) -> double { return h.total_local; } },
+        { "icecream_host_speed", "gauge", "Speed of the host, as reported by the host",
+            [](Host const &h) -> double { return h.getSpeed(); } },
+    };
+
+    auto out = std::make_shared<std::string>();
+    out->reserve(page ? page->size() : 4096);
+
+    std::string labels;
+    size_t max_jobs = 0;
+
+    for (auto const &m : host_metrics) {
+        bool is_counter = !strcmp(m.type, "counter");
+
+        append_metadata(*out, m.name, m.type, m.help);
+        for (auto const &h : Host::hosts) {
+            labels.clear();
+            appendHostLabels(labels, *h.second);
+
+            *out += m.name;
+            if (is_counter)
+                *out += "_total";
+            *out += labels;
+            append_value(*out, m.value(*h.second));
+        }
+    }
+
+    for (auto const &h : Host::hosts)
+        max_jobs += h.second->getMaxJobs();
+
+    append_metadata(*out, "icecream_hosts", "gauge", "Hosts in the farm");
+    *out += "icecream_hosts";
+    append_value(*out, Host::hosts.size());
+
+    append_metadata(*out, "icecream_max_jobs", "gauge", "Jobs the farm can compile at once");
+    *out += "icecream_max_jobs";
+    append_value(*out, max_jobs);
+
+    append_metadata(*out, "icecream_active_jobs", "gauge", "Jobs being compiled");
+    *out += "icecream_active_jobs";
+    append_value(*out, Job::activeCount());
+
+    append_metadata(*out, "icecream_pending_jobs", "gauge", "Jobs waiting for a compile host");
+    *out += "icecream_pending_jobs";
+    append_value(*out, Job::pendingJobs.size());
+
+    append_metadata(*out, "icecream_utilization", "gauge", "Active jobs divided by the jobs the farm can compile at once");
+    *out += "icecream_utilization";
+    append_value(*out, max_jobs ? static_cast<double>(Job::activeCount()) / max_jobs : 0);
+
+    IngestStats stats;
+    bool connected = false;
+    if (scheduler) {
+        stats = scheduler->getIngestStats();
+        connected = scheduler->isConnected();
+    }
+
+    gint64 now = g_get_monotonic_time();
+    double rate = 0;
+    if (last_refresh && now > last_refresh && stats.applied >= last_applied)
+        rate = (stats.applied - last_applied) * 1000000.0 / (now - last_refresh);
+    last_applied = stats.applied;
+    last_refresh = now;
+
+    append_metadata(*out, "icecream_monitor_connected", "gauge", "1 if connected to the scheduler");
+    *out += "icecream_monitor_connected";
+    append_value(*out, connected ? 1 : 0);
+
+    append_metadata(*out, "icecream_monitor_events", "counter", "Scheduler messages applied to the model");
+    *out += "icecream_monitor_events_total";
+    append_value(*out, stats.applied);
+
+    append_metadata(*out, "icecream_monitor_ingest_rate", "gauge", "Scheduler messages applied per second since the last refresh");
+    *out += "icecream_monitor_ingest_rate";
+    append_value(*out, rate);
+
+    if (stats.threaded) {
+        append_metadata(*out, "icecream_monitor_queue_depth", "gauge", "Messages waiting in the ingest queue");
+        *out += "icecream_monitor_queue_depth";
+        append_value(*out, stats.queue_depth);
+
+        append_metadata(*out, "icecream_monitor_dropped_events", "counter", "Messages discarded because they were still queued when a scheduler connection closed");
+        *out += "icecream_monitor_dropped_events_total";
+        append_value(*out, stats.dropped);
+
+        append_metadata(*out, "icecream_monitor_ingest_stalls", "counter", "Times the ingest thread waited for room in the full ingest queue");
+        *out += "icecream_monitor_ingest_stalls_total";
+        append_value(*out, stats.stalls);
+
+        append_metadata(*out, "icecream_monitor_ingest_blocked_seconds", "counter", "Time the ingest thread spent waiting for room in the ingest queue");
+        *out += "icecream_monitor_ingest_blocked_seconds_total";
+        append_value(*out, stats.blocked_us / 1000000.0);
+    }
+
+    *out += "# EOF\n";
+
+    page = std::move(out);
+}
+
+std::unique_ptr<MetricsExporter> create_metrics_exporter(std::string const &address, int port,
+        int interval, bool anonymize)
+{
+    struct addrinfo hints = {};
+    struct addrinfo *result = nullptr;
+
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+
+    std::string service = std::to_string(port);
+    int ret = getaddrinfo(address.empty() ? nullptr : address.c_str(), service.c_str(), &hints, &result);
+    if (ret != 0) {
+        std::cerr << "Unable to resolve metrics address " << address << ": " << gai_strerror(ret) << std::endl;
+        return nullptr;
+    }
+
+    int fd = -1;
+    int error = 0;
+    for (auto *ai = result; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) {
+            error = errno;
+            continue;
+        }
+
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, SOMAXCONN) == 0)
+            break;
+
+        error = errno;
+        ::close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(result);
+
+    if (fd < 0) {
+        std::cerr << "Unable to listen for metrics on " << address << ":" << port << ": " <<
+            strerror(error) << std::endl;
+        return nullptr;
+    }
+
+    return std::make_unique<OpenMetricsExporter>(fd, interval, anonymize);
+}
@@ -0,0 +1,36 @@
+/*
+ * Command line Icecream status monitor
+ * Copyright (C) 2018-2020 by Garmin Ltd. or its subsidiaries.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+class MetricsExporter {
+public:
+    MetricsExporter() {}
+    virtual ~MetricsExporter() {}
+};
+
+// Serves farm metrics in the OpenMetrics text format over HTTP on
+// address:port. The page is rebuilt every interval milliseconds and scrapes
+// are answered from the last one. Returns nullptr if the port can't be
+// listened on
+std::unique_ptr<MetricsExporter> create_metrics_exporter(std::string const &address, int port,
+        int interval, bool anonymize);
@@ -0,0 +1,605 @@
+/*
+ * Command line Icecream status monitor
+ * Copyright (C) 2018-2020 by Garmin Ltd. or its subsidiaries.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <initializer_list>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <glib.h>
+#include <unistd.h>
+
+#include "main.hpp"
+
+int total_remote_jobs = 0;
+int total_local_jobs = 0;
+GMainLoop *main_loop = nullptr;
+bool all_expanded = false;
+std::unique_ptr<Scheduler> scheduler;
+std::unique_ptr<UserInterface> interface;
+ChangeSet model_changes;
+
+// The pool must outlive the lists, so it is defined first
+ObjectPool<Job> Job::pool;
+FlatIdMap<Job*> Job::table;
+Job::StateList Job::pendingJobs;
+Job::StateList Job::localJobs;
+Job::StateList Job::remoteJobs;
+JobHistogram Job::graph;
+WaitHistogram Job::wait_times;
+PathStore Job::filenames;
+RingBuffer<JobRecord> Job::history;
+
+std::vector<int> Host::host_color_ids;
+int Host::localhost_color_id;
+std::map<uint32_t, std::shared_ptr<Host> > Host::hosts;
+Host::Totals Host::totals;
+
+// With a sample every second: 1 second samples for 10 minutes, 10 second
+// samples for 2 hours and 1 minute samples for a day. That is about 5.5KB for
+// each host
+static const std::vector<RollupLevel> utilization_levels = {
+    { 1, 600 },
+    { 10, 720 },
+    { 6, 1440 },
+};
+
+RollupSeries<uint32_t> Host::farm_utilization(utilization_levels);
+
+Job *Job::create(uint32_t id)
+{
+    auto job = find(id);
+
+    if (!job) {
+        job = pool.create(id);
+        table.set(id, job);
+    }
+
+    return job;
+}
+
+Job *Job::find(uint32_t id)
+{
+    auto j = table.find(id);
+
+    if (j)
+        return *j;
+    return nullptr;
+}
+
+void Job::remove(uint32_t id)
+{
+    auto job = find(id);
+    if (!job)
+        return;
+
+    if (job->isActive()) {
+        JobRecord r;
+        r.id = job->id;
+        r.clientid = job->clientid;
+        r.hostid = job->hostid;
+        r.file = job->file;
+        r.start_time = job->start_time;
+        r.end_time = g_get_monotonic_time();
+        r.is_local = job->is_local;
+        history.push(r);
+    }
+
+    touch(job);
+
+    unindex(job);
+    StateList::unlink(job);
+    table.erase(id);
+    pool.destroy(job);
+}
+
+void Job::setState(Job *job, State state)
+{
+    job->state = state;
+
+    switch (state) {
+    case PENDING:
+        pendingJobs.push_back(job);
+        break;
+    case LOCAL:
+        localJobs.push_back(job);
+        break;
+    case REMOTE:
+        remoteJobs.push_back(job);
+        break;
+    }
+}
+
+void Job::index(Job *job)
+{
+    auto client = job->getClient();
+    if (client) {
+        if (job->isActive())
+            client->active_jobs.push_back(job);
+        else
+            client->pending_jobs.push_back(job);
+    }
+
+    if (job->isActive()) {
+        job->color = client ? client->getColor() : 0;
+        graph.add(job->color, job->is_local);
+
+        auto host = job->getHost();
+        if (host) {
+            host->account(false);
+            host->current_jobs.push_back(job);
+            host->account(true);
+            host->job_graph.add(job->color, job->is_local);
+            job->host_slot = host->job_slots.claim(job);
+        }
+    }
+}
+
+// Marks the job and the hosts it currently involves as changed. Transitions
+// call this before and after, so that both the old and new hosts are marked
+void Job::touch(Job *job)
+{
+    model_changes.addJob(job->id);
+    model_changes.addHost(job->clientid);
+    model_changes.addHost(job->hostid);
+    model_changes.changed();
+}
+
+void Job::unindex(Job *job)
+{
+    std::shared_ptr<Host> server;
+
+    if (job->isActive()) {
+        graph.remove(job->color, job->is_local);
+
+        auto host = job->getHost();
+        if (host && host->current_jobs.contains(job)) {
+            host->job_graph.remove(job->color, job->is_local);
+            host->job_slots.release(job->host_slot);
+            host->account(false);
+            server = host;
+        }
+        job->host_slot = SIZE_MAX;
+    }
+
+    ClientList::unlink(job);
+    ServerList::unlink(job);
+
+    if (server)
+        server->account(true);
+}
+
+void Job::updateColor(Job *job)
+{
+    if (!job->isActive())
+        return;
+
+    auto client = job->getClient();
+    int color = client ? client->getColor() : 0;
+    if (color == job->color)
+        return;
+
+    // The job stays where it is in the lists, so that callers can update
+    // all the jobs in a list
+    graph.remove(job->color, job->is_local);
+    graph.add(color, job->is_local);
+
+    auto host = job->getHost();
+    if (host && host->current_jobs.contains(job)) {
+        host->job_graph.remove(job->color, job->is_local);
+        host->job_graph.add(color, job->is_local);
+    }
+
+    job->color = color;
+    touch(job);
+}
+
+void Job::createLocal(uint32_t id, uint32_t hostid, StringRef filename)
+{
+    auto job = Job::create(id);
+
+    touch(job);
+    unindex(job);
+
+    job->clientid = hostid;
+    job->hostid = hostid;
+    job->is_local = true;
+    job->file = filenames.intern(filename);
+    job->start_time = g_get_monotonic_time();
+
+    auto h = job->getClient();
+    if (h)
+        h->total_local++;
+    total_local_jobs++;
+
+    setState(job, LOCAL);
+    index(job);
+    touch(job);
+}
+
+void Job::createPending(uint32_t id, uint32_t clientid, StringRef filename)
+{
+    auto job = Job::create(id);
+
+    touch(job);
+    unindex(job);
+
+    job->clientid = clientid;
+    job->file = filenames.intern(filename);
+    job->pending_time = g_get_monotonic_time();
+
+    setState(job, PENDING);
+    index(job);
+    touch(job);
+}
+
+void Job::createRemote(uint32_t id, uint32_t hostid)
+{
+    auto job = Job::find(id);
+
+    if (!job)
+        return;
+
+    touch(job);
+    unindex(job);
+
+    job->hostid = hostid;
+    job->start_time = g_get_monotonic_time();
+
+    auto host = job->getHost();
+    if (host)
+        host->total_in++;
+
+    auto client = job->getClient();
+    if (client)
+        client->total_out++;
+    total_remote_jobs++;
+
+    if (job->state == PENDING && job->pending_time) {
+        guint64 wait = job->start_time - std::min(job->pending_time, job->start_time);
+
+        wait_times.add(wait);
+        if (client)
+            client->wait_times.add(wait);
+    }
+
+    setState(job, REMOTE);
+    index(job);
+    touch(job);
+}
+
+void Job::clearAll()
+{
+    for (auto *list : { &pendingJobs, &localJobs, &remoteJobs }) {
+        while (!list->empty()) {
+            auto *job = list->front();
+
+            unindex(job);
+            list->erase(job);
+            pool.destroy(job);
+        }
+    }
+    table.clear();
+}
+
+std::shared_ptr<Host> Job::getClient() const
+{
+    if (!clientid)
+        return nullptr;
+
+    return Host::find(clientid);
+}
+
+std::shared_ptr<Host> Job::getHost() const
+{
+    if (!hostid)
+        return nullptr;
+
+    return Host::find(hostid);
+}
+
+void ChangeSet::changed()
+{
+    if (m_batch_depth)
+        m_pending = true;
+    else if (interface)
+        interface->triggerRedraw();
+}
+
+void ChangeSet::endBatch()
+{
+    assert(m_batch_depth > 0);
+
+    if (--m_batch_depth == 0 && m_pending) {
+        m_pending = false;
+        if (interface)
+            interface->triggerRedraw();
+    }
+}
+
+std::shared_ptr<Host> Host::create(uint32_t id)
+{
+    class RealHost: public Host {
+    public:
+        explicit RealHost(uint32_t id): Host(id) {}
+        virtual ~RealHost() {}
+    };
+
+    auto host = find(id);
+
+    if (!host) {
+        host = std::make_shared<RealHost>(id);
+        host->utilization.setLevels(utilization_levels);
+        hosts[id] = host;
+
+        // Pick up any jobs that referenced this host before it was known
+        for (auto *j : Job::pendingJobs) {
+            if (j->clientid == id)
+                host->pending_jobs.push_back(j);
+        }
+
+        for (auto *list : { &Job::localJobs, &Job::remoteJobs }) {
+            for (auto *j : *list) {
+                if (j->clientid == id)
+                    host->active_jobs.push_back(j);
+                if (j->hostid == id) {
+                    host->current_jobs.push_back(j);
+                    host->job_graph.add(j->color, j->is_local);
+                    j->host_slot = host->job_slots.claim(j);
+                }
+            }
+        }
+
+        // Adopted jobs were drawn without a client color until now
+        for (auto *j : host->active_jobs)
+            Job::updateColor(j);
+
+        host->listed = true;
+        host->account(true);
+
+        model_changes.addHost(id);
+        model_changes.setLayoutChanged();
+        model_changes.changed();
+    }
+
+    return host;
+}
+
+void Host::sampleUtilization()
+{
+    uint64_t farm_busy = 0;
+
+    for (auto const &h : hosts) {
+        uint64_t busy = h.second->current_jobs.size() * UTILIZATION_SCALE;
+
+        h.second->utilization.push(std::min<uint64_t>(busy, UINT16_MAX));
+        farm_busy += busy;
+    }
+
+    farm_utilization.push(std::min<uint64_t>(farm_busy, UINT32_MAX));
+}
+
+unsigned Host::getUtilizationInterval(size_t level)
+{
+    unsigned ms = UTILIZATION_INTERVAL_MS;
+
+    for (size_t i = 1; i <= level && i < utilization_levels.size(); i++)
+        ms *= utilization_levels[i].factor;
+
+    return ms / 1000;
+}
+
+std::shared_ptr<Host> Host::find(uint32_t id)
+{
+    auto h = hosts.find(id);
+
+    if (h != hosts.end())
+        return h->second;
+
+    return nullptr;
+}
+
+void Host::remove(uint32_t id)
+{
+    auto h = hosts.find(id);
+
+    if (h != hosts.end()) {
+        auto host = h->second;
+        host->account(false);
+        host->listed = false;
+        hosts.erase(h);
+        model_changes.addHost(id);
+
+        // Jobs from a host that is no longer known lose their client color
+        for (auto *j : host->active_jobs)
+            Job::updateColor(j);
+
+        model_changes.setLayoutChanged();
+        model_changes.changed();
+    }
+}
+
+void Host::clearAll()
+{
+    for (auto const &h : hosts)
+        h.second->listed = false;
+
+    hosts.clear();
+    totals = Totals();
+}
+
+void Host::account(bool add)
+{
+    if (!listed)
+        return;
+
+    auto update = [add](size_t &total, size_t count) {
+        if (add)
+            total += count;
+        else
+            total -= count;
+    };
+
+    if (!profile.no_remote) {
+        update(totals.available, 1);
+        update(totals.slots, profile.max_jobs);
+    }
+
+    if (!current_jobs.empty())
+        update(totals.busy, 1);
+
+    if (network >= totals.network_hosts.size()) {
+        totals.network_hosts.resize(network + 1);
+        totals.network_jobs.resize(network + 1);
+    }
+    update(totals.network_hosts[network], 1);
+    update(totals.network_jobs[network], current_jobs.size());
+}
+
+void Host::setNetwork(size_t index)
+{
+    if (index == network)
+        return;
+
+    account(false);
+    network = index;
+    account(true);
+
+    // The host shows the name of its network
+    model_changes.addHost(id);
+    model_changes.changed();
+}
+
+int Host::getColor() const
+{
+    if (profile.is_localhost)
+        return localhost_color_id;
+
+    if (host_color_ids.empty())
+        return 0;
+
+    return host_color_ids[profile.name_hash % host_color_ids.size()];
+}
+
+void Host::updateProfile()
+{
+    account(false);
+    profile.name = getStringAttr("Name");
+    profile.platform = getStringAttr("Platform");
+    profile.max_jobs = getSizeAttr("MaxJobs");
+    profile.speed = getDoubleAttr("Speed");
+    profile.no_remote = getBoolAttr("NoRemote");
+    account(true);
+    profile.is_localhost = !profile.name.empty() && profile.name == getLocalHostname();
+    profile.name_hash = std::hash<std::string>{}(profile.name);
+
+    // The color depends on the name
+    for (auto *j : active_jobs)
+        Job::updateColor(j);
+}
+
+bool Host::updateAttributes(StringRef stats, bool &alive)
+{
+    bool changed = false;
+    alive = false;
+
+    while (!stats.empty()) {
+        StringRef line = stats.split('\n');
+        size_t colon = line.find(':');
+
+        if (colon == StringRef::npos)
+            continue;
+
+        StringRef key = line.substr(0, colon);
+        StringRef value = line.substr(colon + 1);
+
+        if (key == "Name")
+            alive = true;
+
+        auto i = attr.find(key);
+        if (i == attr.end()) {
+            attr.emplace(key.str(), value.str());
+            changed = true;
+        } else if (i->second != value) {
+            i->second.assign(value.data(), value.size());
+            changed = true;
+        }
+    }
+
+    if (changed)
+        updateProfile();
+
+    return changed;
+}
+
+std::string Host::getStringAttr(std::string const &name, std::string const &dflt) const
+{
+    auto const i = attr.find(name);
+    if (i == attr.end())
+        return dflt;
+    return i->second;
+}
+
+size_t Host::getSizeAttr(std::string const &name, size_t dflt) const
+{
+    auto const i = attr.find(name);
+    if (i == attr.end())
+        return dflt;
+
+    return strtoull(i->second.c_str(), nullptr, 10);
+}
+
+double Host::getDoubleAttr(std::string const &name, double dflt) const
+{
+    auto const i = attr.find(name);
+    if (i == attr.end())
+        return dflt;
+
+    return strtod(i->second.c_str(), nullptr);
+}
+
+bool Host::getBoolAttr(std::string const &name, bool dflt) const
+{
+    auto const i = attr.find(name);
+    if (i == attr.end())
+        return dflt;
+
+    return i->second == "true";
+}
+
+std::string const &Host::getLocalHostname()
+{
+    static std::string hostname;
+    static bool init = false;
+
+    if (!init) {
+        char buffer[1024];
+
+        if (gethostname(buffer, sizeof(buffer)) == 0) {
+            buffer[sizeof(buffer) - 1] = '\0';
+            hostname = buffer;
+        }
+        init = true;
+    }
+
+    return hostname;
+}
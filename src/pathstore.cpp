@@ -0,0 +1,142 @@
+/*
+ * Command line Icecream status monitor
+ * Copyright (C) 2018-2020 by Garmin Ltd. or its subsidiaries.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <algorithm>
+
+#include "pathstore.hpp"
+
+const PathStore::Handle PathStore::EMPTY;
+
+static uint32_t hash_component(uint32_t parent, StringRef name)
+{
+    // FNV-1a, seeded with the parent so equal names in different
+    // directories land in different buckets
+    uint32_t h = 2166136261u ^ (parent * 16777619u);
+    for (char c : name) {
+        h ^= static_cast<unsigned char>(c);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+PathStore::PathStore()
+{
+    // Node 0 is the root, which is also the empty path
+    m_nodes.push_back(Node{0, 0, 0, 0});
+    m_buckets.resize(1024, EMPTY);
+}
+
+PathStore::Handle PathStore::intern(StringRef path)
+{
+    Handle h = EMPTY;
+
+    if (path.empty())
+        return h;
+
+    // Split on every separator so that the path round trips exactly,
+    // including leading, trailing and repeated slashes
+    for (;;) {
+        size_t sep = path.find('/');
+        h = internComponent(h, path.substr(0, sep));
+        if (sep == StringRef::npos)
+            break;
+        path = path.substr(sep + 1);
+    }
+
+    return h;
+}
+
+PathStore::Handle PathStore::internComponent(Handle parent, StringRef n)
+{
+    uint32_t hash = hash_component(parent, n);
+    size_t mask = m_buckets.size() - 1;
+
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        Handle b = m_buckets[i];
+        if (b == EMPTY) {
+            Handle h = m_nodes.size();
+
+            m_nodes.push_back(Node{parent, static_cast<uint32_t>(m_names.size()),
+                    static_cast<uint32_t>(n.size()), hash});
+            m_names.insert(m_names.end(), n.begin(), n.end());
+            m_buckets[i] = h;
+
+            if (m_nodes.size() * 2 > m_buckets.size())
+                grow();
+
+            return h;
+        }
+
+        Node const &node = m_nodes[b];
+        if (node.hash == hash && node.parent == parent && name(node) == n)
+            return b;
+    }
+}
+
+void PathStore::grow()
+{
+    std::vector<Handle> buckets(m_buckets.size() * 2, EMPTY);
+    size_t mask = buckets.size() - 1;
+
+    for (Handle h = 1; h < m_nodes.size(); h++) {
+        size_t i = m_nodes[h].hash & mask;
+        while (buckets[i] != EMPTY)
+            i = (i + 1) & mask;
+        buckets[i] = h;
+    }
+
+    m_buckets.swap(buckets);
+}
+
+void PathStore::append(Handle h, std::string &out) const
+{
+    if (h == EMPTY)
+        return;
+
+    // Measure the path on the way up to the root, then fill it in from the
+    // end on a second walk, so paths of any depth are built in place
+    size_t length = 0;
+    for (Handle p = h; p != EMPTY; p = m_nodes[p].parent)
+        length += m_nodes[p].name_length + 1;
+
+    // There is no separator before the first component
+    size_t end = out.size() + length - 1;
+    out.resize(end);
+
+    for (Handle p = h; p != EMPTY; p = m_nodes[p].parent) {
+        StringRef n = name(m_nodes[p]);
+        end -= n.size();
+        std::copy(n.begin(), n.end(), out.begin() + end);
+        if (m_nodes[p].parent != EMPTY)
+            out[--end] = '/';
+    }
+}
+
+std::string PathStore::str(Handle h) const
+{
+    std::string s;
+    append(h, s);
+    return s;
+}
+
+size_t PathStore::memoryUsage() const
+{
+    return m_nodes.capacity() * sizeof(Node) + m_names.capacity() +
+        m_buckets.capacity() * sizeof(Handle);
+}
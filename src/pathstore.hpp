@@ -0,0 +1,77 @@
+/*
+ * Command line Icecream status monitor
+ * Copyright (C) 2018-2020 by Garmin Ltd. or its subsidiaries.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "strref.hpp"
+
+// Interns file paths. Each path is split at '/' into components which are
+// stored as a tree, so a directory shared by many files is only stored once.
+// A path is identified by the handle of its last component; handles are
+// never released, and equal paths always get the same handle, so comparing
+// paths is an integer comparison.
+class PathStore {
+public:
+    typedef uint32_t Handle;
+
+    // Handle of the empty path
+    static const Handle EMPTY = 0;
+
+    PathStore();
+
+    Handle intern(StringRef path);
+
+    std::string str(Handle h) const;
+
+    // Appends the full path for the handle to out
+    void append(Handle h, std::string &out) const;
+
+    // Number of distinct path components stored
+    size_t size() const
+    {
+        return m_nodes.size() - 1;
+    }
+
+    // Approximate number of bytes used by the store
+    size_t memoryUsage() const;
+
+private:
+    struct Node {
+        Handle parent;
+        uint32_t name_offset;
+        uint32_t name_length;
+        uint32_t hash;
+    };
+
+    Handle internComponent(Handle parent, StringRef name);
+    StringRef name(Node const &n) const
+    {
+        return StringRef(m_names.data() + n.name_offset, n.name_length);
+    }
+    void grow();
+
+    std::vector<Node> m_nodes;
+    std::vector<char> m_names;
+    // Open addressing table of node indices, 0 is empty
+    std::vector<Handle> m_buckets;
+};
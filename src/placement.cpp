@@ -0,0 +1,167 @@
+/*
+ * Command line Icecream status monitor
+ * Copyright (C) 2018-2020 by Garmin Ltd. or its subsidiaries.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <cstdlib>
+#include <sstream>
+
+#include "placement.hpp"
+
+class RandomPlacement: public PlacementPolicy {
+public:
+    explicit RandomPlacement(std::minstd_rand &r) : random(r) {}
+    virtual ~RandomPlacement() {}
+
+    virtual uint32_t choose(PlacementFarm const &farm, uint32_t client) override
+    {
+        auto const &free = farm.getFreeHosts();
+        size_t excluded = free.indexOf(client);
+        size_t count = free.size() - (excluded < free.size() ? 1 : 0);
+
+        if (!count)
+            return 0;
+
+        // Pick from the others by skipping over the client
+        std::uniform_int_distribution<size_t> dis(0, count - 1);
+        size_t n = dis(random);
+        if (n >= excluded)
+            n++;
+
+        return free[n];
+    }
+
+private:
+    std::minstd_rand &random;
+};
+
+// Picks the free host with the best score. Ties go to the first one found
+class ScoredPlacement: public PlacementPolicy {
+public:
+    virtual ~ScoredPlacement() {}
+
+    virtual uint32_t choose(PlacementFarm const &farm, uint32_t client) override
+    {
+        auto const &free = farm.getFreeHosts();
+        uint32_t best = 0;
+        double best_score = -1;
+
+        for (size_t i = 0; i < free.size(); i++) {
+            uint32_t id = free[i];
+            if (id == client)
+                continue;
+
+            double s = score(farm, id);
+            if (s > best_score) {
+                best = id;
+                best_score = s;
+            }
+        }
+        return best;
+    }
+
+protected:
+    virtual double score(PlacementFarm const &farm, uint32_t id) const = 0;
+};
+
+class FastestPlacement: public ScoredPlacement {
+public:
+    virtual ~FastestPlacement() {}
+
+protected:
+    virtual double score(PlacementFarm const &farm, uint32_t id) const override
+    {
+        return farm.getSpeed(id);
+    }
+};
+
+// The icecream scheduler prefers fast hosts, but backs off from hosts as
+// they get busy, so a fast host with one free slot can lose to a slower
+// idle one
+class IcecreamPlacement: public ScoredPlacement {
+public:
+    virtual ~IcecreamPlacement() {}
+
+protected:
+    virtual double score(PlacementFarm const &farm, uint32_t id) const override
+    {
+        double max_jobs = farm.getMaxJobs(id);
+        double load = max_jobs ? farm.getCurrentJobs(id) / max_jobs : 1;
+
+        return farm.getSpeed(id) * (1 - load);
+    }
+};
+
+std::unique_ptr<PlacementPolicy> create_placement_policy(std::string const &name, std::minstd_rand &random)
+{
+    if (name == "random")
+        return std::make_unique<RandomPlacement>(random);
+    if (name == "fastest")
+        return std::make_unique<FastestPlacement>();
+    if (name == "icecream")
+        return std::make_unique<IcecreamPlacement>();
+    return nullptr;
+}
+
+std::vector<std::string> const &get_placement_policy_names()
+{
+    static const std::vector<std::string> names = { "random", "fastest", "icecream" };
+    return names;
+}
+
+bool parse_farm_spec(std::string const &spec, FarmSpec &farm)
+{
+    std::istringstream ss(spec);
+    std::string item;
+
+    farm = FarmSpec();
+
+    while (std::getline(ss, item, '+')) {
+        if (item == "current") {
+            farm.current = true;
+            continue;
+        }
+
+        FarmSpec::Group group;
+        char const *p = item.c_str();
+        char *end;
+
+        group.count = strtol(p, &end, 10);
+        if (end == p || *end != 'x' || group.count <= 0)
+            return false;
+
+        p = end + 1;
+        group.slots = strtol(p, &end, 10);
+        if (end == p || group.slots <= 0)
+            return false;
+
+        group.speed = 100;
+        if (*end == '@') {
+            p = end + 1;
+            group.speed = strtod(p, &end);
+            if (end == p || group.speed <= 0)
+                return false;
+        }
+
+        if (*end)
+            return false;
+
+        farm.groups.push_back(group);
+    }
+
+    return farm.current || !farm.groups.empty();
+}
@@ -0,0 +1,86 @@
+/*
+ * Command line Icecream status monitor
+ * Copyright (C) 2018-2020 by Garmin Ltd. or its subsidiaries.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "containers.hpp"
+
+// The hosts a placement policy can choose from. Hosts are identified by
+// non-zero ids
+class PlacementFarm {
+public:
+    virtual ~PlacementFarm() {}
+
+    // Hosts that accept remote jobs and have a free slot
+    virtual IdSet const &getFreeHosts() const = 0;
+
+    virtual size_t getCurrentJobs(uint32_t id) const = 0;
+    virtual size_t getMaxJobs(uint32_t id) const = 0;
+    virtual double getSpeed(uint32_t id) const = 0;
+};
+
+// Decides which host compiles a job, like the scheduler does
+class PlacementPolicy {
+public:
+    virtual ~PlacementPolicy() {}
+
+    // Returns a free host other than client for a job, or 0 to leave the
+    // job pending
+    virtual uint32_t choose(PlacementFarm const &farm, uint32_t client) = 0;
+};
+
+// The known policies:
+//  random      any free host
+//  fastest     the free host with the highest speed
+//  icecream    like the icecream scheduler, the fastest host, weighted by
+//              the fraction of its slots that are free
+//
+// Returns nullptr if name is unknown. random must outlive the policy
+std::unique_ptr<PlacementPolicy> create_placement_policy(std::string const &name, std::minstd_rand &random);
+
+std::vector<std::string> const &get_placement_policy_names();
+
+// A farm described by a string of '+' separated groups of hosts, e.g.
+// "current+20x16@150":
+//
+//  current         the hosts the monitor knows about
+//  COUNTxSLOTS     COUNT hosts with SLOTS job slots each, at speed 100
+//  COUNTxSLOTS@SPEED
+//                  the same at a given speed
+struct FarmSpec {
+    struct Group {
+        int count;
+        int slots;
+        double speed;
+        // Hosts that only submit jobs. Only used for the current hosts
+        bool no_remote = false;
+    };
+
+    bool current = false;
+    std::vector<Group> groups;
+};
+
+// Returns false if spec isn't a valid farm description
+bool parse_farm_spec(std::string const &spec, FarmSpec &farm);
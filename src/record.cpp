@@ -0,0 +1,205 @@
+/*
+ * Command line Icecream status monitor
+ * Copyright (C) 2018-2020 by Garmin Ltd. or its subsidiaries.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "record.hpp"
+
+#define RECORD_MAGIC "ICSR"
+#define RECORD_MAGIC_SIZE (4)
+#define RECORD_VERSION (1)
+
+// Recorded events are written out in chunks of about this size
+#define RECORD_BUFFER_SIZE (64 * 1024)
+
+EventRecorder::EventRecorder(FILE *file) :
+    m_file(file)
+{
+    m_buffer.reserve(RECORD_BUFFER_SIZE * 2);
+    m_buffer.append(RECORD_MAGIC, RECORD_MAGIC_SIZE);
+    putVarint(RECORD_VERSION);
+}
+
+EventRecorder::~EventRecorder()
+{
+    flush();
+    fclose(m_file);
+}
+
+void EventRecorder::record(MonitorEvent const &event)
+{
+    // Events from the ingest thread are time stamped there, but they are
+    // still in order
+    gint64 delta = m_last_time ? std::max<gint64>(event.time - m_last_time, 0) : 0;
+    m_last_time = std::max(m_last_time, event.time);
+
+    m_buffer.push_back(static_cast<char>(event.type));
+    putVarint(delta);
+    putVarint(event.job_id);
+    putVarint(event.hostid);
+    putVarint(event.clientid);
+    putVarint(event.text.size());
+    m_buffer.append(event.text);
+
+    if (m_buffer.size() >= RECORD_BUFFER_SIZE)
+        flush();
+}
+
+void EventRecorder::flush()
+{
+    if (!m_failed && !m_buffer.empty()) {
+        if (fwrite(m_buffer.data(), 1, m_buffer.size(), m_file) != m_buffer.size() || fflush(m_file) != 0) {
+            std::cerr << "Unable to write recording: " << strerror(errno) << std::endl;
+            m_failed = true;
+        }
+    }
+    m_buffer.clear();
+}
+
+void EventRecorder::putVarint(uint64_t v)
+{
+    while (v >= 0x80) {
+        m_buffer.push_back(static_cast<char>(v | 0x80));
+        v >>= 7;
+    }
+    m_buffer.push_back(static_cast<char>(v));
+}
+
+std::unique_ptr<EventRecorder> create_event_recorder(std::string const &path)
+{
+    FILE *file = fopen(path.c_str(), "wb");
+    if (!file) {
+        std::cerr << "Unable to create " << path << ": " << strerror(errno) << std::endl;
+        return nullptr;
+    }
+
+    return std::make_unique<EventRecorder>(file);
+}
+
+EventReader::EventReader(char const *data, size_t size, bool unmap) :
+    m_data(data), m_size(size), m_unmap(unmap)
+{
+    uint64_t version = 0;
+
+    if (m_size < RECORD_MAGIC_SIZE || memcmp(m_data, RECORD_MAGIC, RECORD_MAGIC_SIZE)) {
+        m_corrupt = true;
+        return;
+    }
+
+    m_pos = RECORD_MAGIC_SIZE;
+    if (!getVarint(version) || version != RECORD_VERSION) {
+        m_corrupt = true;
+        m_corrupt_offset = RECORD_MAGIC_SIZE;
+    }
+}
+
+EventReader::~EventReader()
+{
+    if (m_unmap && m_size)
+        munmap(const_cast<char*>(m_data), m_size);
+}
+
+bool EventReader::next(MonitorEvent &event)
+{
+    if (m_corrupt || m_pos >= m_size)
+        return false;
+
+    size_t start = m_pos;
+    uint8_t type = m_data[m_pos++];
+    uint64_t delta, job_id, hostid, clientid, length;
+
+    if (type > MonitorEvent::END || !getVarint(delta) || !getVarint(job_id) || !getVarint(hostid) ||
+            !getVarint(clientid) || !getVarint(length) || length > m_size - m_pos) {
+        m_corrupt = true;
+        m_corrupt_offset = start;
+        return false;
+    }
+
+    m_time += delta;
+
+    event.type = static_cast<MonitorEvent::Type>(type);
+    event.time = m_time;
+    event.job_id = job_id;
+    event.hostid = hostid;
+    event.clientid = clientid;
+    event.text.assign(m_data + m_pos, length);
+    m_pos += length;
+
+    return true;
+}
+
+bool EventReader::getVarint(uint64_t &v)
+{
+    v = 0;
+
+    for (unsigned shift = 0; shift < 64 && m_pos < m_size; shift += 7) {
+        uint8_t b = m_data[m_pos++];
+
+        v |= static_cast<uint64_t>(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return true;
+    }
+    return false;
+}
+
+std::unique_ptr<EventReader> open_event_reader(std::string const &path)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        std::cerr << "Unable to open " << path << ": " << strerror(errno) << std::endl;
+        return nullptr;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        std::cerr << "Unable to read " << path << ": " << strerror(errno) << std::endl;
+        close(fd);
+        return nullptr;
+    }
+
+    void *data = nullptr;
+    size_t size = st.st_size;
+
+    if (size) {
+        data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            std::cerr << "Unable to map " << path << ": " << strerror(errno) << std::endl;
+            close(fd);
+            return nullptr;
+        }
+        madvise(data, size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    auto reader = std::make_unique<EventReader>(static_cast<char const*>(data), size, true);
+    if (reader->isCorrupt()) {
+        std::cerr << path << " is not a recording" << std::endl;
+        return nullptr;
+    }
+
+    return reader;
+}
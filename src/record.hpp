@@ -0,0 +1,101 @@
+/*
+ * Command line Icecream status monitor
+ * Copyright (C) 2018-2020 by Garmin Ltd. or its subsidiaries.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+
+#include "event.hpp"
+
+// Recordings of the scheduler monitor stream. A recording is the magic
+// "ICSR" and a format version, followed by one record per event:
+//
+//  type                 1 byte
+//  time                 microseconds since the previous event
+//  job_id, hostid,
+//  clientid             the event's fields
+//  text                 length, then the bytes
+//
+// Everything except the type is an unsigned LEB128 varint, so most records
+// only take a few bytes more than their text. An END record marks where a
+// scheduler connection started; the model starts over from there.
+
+class EventRecorder {
+public:
+    explicit EventRecorder(FILE *file);
+    ~EventRecorder();
+
+    EventRecorder(EventRecorder const &) = delete;
+    EventRecorder &operator=(EventRecorder const &) = delete;
+
+    void record(MonitorEvent const &event);
+
+    // Writes out everything recorded so far
+    void flush();
+
+private:
+    void putVarint(uint64_t v);
+
+    FILE *m_file;
+    std::string m_buffer;
+    gint64 m_last_time = 0;
+    bool m_failed = false;
+};
+
+// Returns nullptr if path can't be created
+std::unique_ptr<EventRecorder> create_event_recorder(std::string const &path);
+
+// Decodes a recording from memory, normally a read only mapping of the file
+class EventReader {
+public:
+    // If unmap is set, data is munmap()ed when the reader is destroyed
+    EventReader(char const *data, size_t size, bool unmap);
+    ~EventReader();
+
+    EventReader(EventReader const &) = delete;
+    EventReader &operator=(EventReader const &) = delete;
+
+    // Decodes the next event into event, reusing its storage. Returns false
+    // at the end of the recording or when the rest of it is corrupt
+    bool next(MonitorEvent &event);
+
+    bool isCorrupt() const { return m_corrupt; }
+
+    // Byte offset in the recording of what couldn't be decoded, if it is
+    // corrupt
+    size_t getCorruptOffset() const { return m_corrupt_offset; }
+
+private:
+    bool getVarint(uint64_t &v);
+
+    char const *m_data;
+    size_t m_size;
+    size_t m_pos = 0;
+    bool m_unmap;
+    gint64 m_time = 0;
+    bool m_corrupt = false;
+    size_t m_corrupt_offset = 0;
+};
+
+// Maps the recording at path. Returns nullptr if it can't be read or isn't a
+// recording
+std::unique_ptr<EventReader> open_event_reader(std::string const &path);
@@ -0,0 +1,176 @@
+/*
+ * Command line Icecream status monitor
+ * Copyright (C) 2018-2020 by Garmin Ltd. or its subsidiaries.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <glib.h>
+#include <iostream>
+
+#include "main.hpp"
+#include "record.hpp"
+#include "replay.hpp"
+
+static void apply_recorded_event(MonitorEvent const &event)
+{
+    // The recording started over with a new scheduler connection
+    if (event.type == MonitorEvent::END) {
+        Host::clearAll();
+        Job::clearAll();
+        model_changes.setReset();
+        model_changes.changed();
+    } else {
+        apply_monitor_event(event);
+    }
+}
+
+class Replay: public Scheduler {
+public:
+    Replay(std::unique_ptr<EventReader> reader, std::string const &name, double speed, bool exit_at_end,
+            BatchLimits const &limits);
+    virtual ~Replay() {}
+
+    virtual std::string getNetName() const override { return "REPLAY"; }
+    virtual std::string getSchedulerName() const override { return name; }
+
+    virtual IngestStats getIngestStats() const override
+    {
+        IngestStats stats;
+        stats.applied = applied;
+        return stats;
+    }
+
+private:
+    static gboolean on_step(gpointer user_data);
+
+    void schedule();
+    void step();
+    void apply(MonitorEvent const &event);
+
+    // Monotonic time at which the next event is due
+    gint64 getDueTime() const;
+
+    std::unique_ptr<EventReader> reader;
+    std::string name;
+    double speed;
+    bool exit_at_end;
+    BatchLimits limits;
+    GlibSource step_source;
+
+    // The next event, read ahead to know when it is due
+    MonitorEvent next;
+    bool have_next = false;
+
+    gint64 start_time = 0;
+    gint64 first_event_time = 0;
+    uint64_t applied = 0;
+};
+
+// The reader stops at a corrupt event, so the replay ends early. Says so,
+// rather than passing it off as the end of the recording
+static void check_corrupt(EventReader const &reader)
+{
+    if (reader.isCorrupt())
+        std::cerr << "The recording is corrupt at byte " << reader.getCorruptOffset() <<
+            ", the rest of it is ignored" << std::endl;
+}
+
+Replay::Replay(std::unique_ptr<EventReader> r, std::string const &n, double s, bool e, BatchLimits const &l) :
+    Scheduler(), reader(std::move(r)), name(n), speed(s), exit_at_end(e), limits(l)
+{
+    have_next = reader->next(next);
+    if (!have_next)
+        check_corrupt(*reader);
+    first_event_time = next.time;
+    start_time = g_get_monotonic_time();
+
+    // Even an empty recording ends from the main loop, so that it can quit
+    step_source.set(g_idle_add(on_step, this));
+}
+
+gint64 Replay::getDueTime() const
+{
+    if (speed <= 0)
+        return 0;
+
+    return start_time + static_cast<gint64>((next.time - first_event_time) / speed);
+}
+
+gboolean Replay::on_step(gpointer user_data)
+{
+    auto *self = static_cast<Replay*>(user_data);
+
+    self->step_source.clear();
+    self->step();
+    self->schedule();
+    return FALSE;
+}
+
+// Waits for the next event to be due. Events that are already due are
+// applied from an idle source, one batch per main loop iteration
+void Replay::schedule()
+{
+    if (!have_next) {
+        if (exit_at_end)
+            g_main_loop_quit(main_loop);
+        return;
+    }
+
+    gint64 delay = getDueTime() - g_get_monotonic_time();
+
+    if (delay > 0)
+        step_source.set(g_timeout_add((delay + 999) / 1000, on_step, this));
+    else
+        step_source.set(g_idle_add(on_step, this));
+}
+
+void Replay::step()
+{
+    EventBatch batch(limits);
+    gint64 now = g_get_monotonic_time();
+
+    while (have_next && getDueTime() <= now) {
+        if (!batch.next())
+            break;
+
+        apply(next);
+        have_next = reader->next(next);
+        if (!have_next)
+            check_corrupt(*reader);
+    }
+}
+
+void Replay::apply(MonitorEvent const &event)
+{
+    apply_recorded_event(event);
+    applied++;
+}
+
+std::unique_ptr<Scheduler> create_replay(std::unique_ptr<EventReader> reader, std::string const &name,
+        double speed, bool exit_at_end, BatchLimits const &limits)
+{
+    return std::make_unique<Replay>(std::move(reader), name, speed, exit_at_end, limits);
+}
+
+void apply_recording(EventReader &reader)
+{
+    MonitorEvent event;
+
+    while (reader.next(event))
+        apply_recorded_event(event);
+
+    check_corrupt(reader);
+}
@@ -0,0 +1,39 @@
+/*
+ * Command line Icecream status monitor
+ * Copyright (C) 2018-2020 by Garmin Ltd. or its subsidiaries.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "event.hpp"
+
+class Scheduler;
+class EventReader;
+
+// Feeds a recording to the model as if it came from a scheduler. speed
+// scales the recorded timing (2 is twice as fast); 0 applies the events as
+// fast as the limits allow. If exit_at_end is set, the main loop quits once
+// the recording is done
+std::unique_ptr<Scheduler> create_replay(std::unique_ptr<EventReader> reader, std::string const &name,
+        double speed, bool exit_at_end, BatchLimits const &limits = BatchLimits());
+
+// Applies the rest of a recording to the model at once, leaving it in the
+// state the recorded farm was in at the end
+void apply_recording(EventReader &reader);
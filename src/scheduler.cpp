@@ -17,16 +17,25 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
-#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
 
 #include <glib.h>
 #include <glib-unix.h>
 #include <icecc/comm.h>
+#include <fcntl.h>
 #include <poll.h>
+#include <unistd.h>
 
 #include "main.hpp"
+#include "containers.hpp"
+#include "event.hpp"
 #include "scheduler.hpp"
+#include "spsc_queue.hpp"
 
 #if ICECC_TEST_USE_OLD_MSG_API
 #define ICECC_MSG_API_COMPAT(old, new) old
@@ -34,95 +43,706 @@
 #define ICECC_MSG_API_COMPAT(old, new) new
 #endif
 
+#define INGEST_QUEUE_SIZE (16384)
+
+// How often discovery is stepped when no socket activity wakes it up
+#define DISCOVER_POLL_MS (100)
+
+// Converts an icecc monitor message to an event. Returns false if the
+// message is not one the monitor cares about
+static bool decode_message(Msg *msg, MonitorEvent &event)
+{
+    event.time = g_get_monotonic_time();
+    event.job_id = 0;
+    event.hostid = 0;
+    event.clientid = 0;
+    event.text.clear();
+
+    switch (ICECC_MSG_API_COMPAT(msg->type, *msg)) {
+    case ICECC_MSG_API_COMPAT(M_MON_LOCAL_JOB_BEGIN, Msg::MON_LOCAL_JOB_BEGIN): {
+        auto *m = dynamic_cast<MonLocalJobBeginMsg*>(msg);
+        event.type = MonitorEvent::LOCAL_JOB_BEGIN;
+        event.job_id = m->job_id;
+        event.hostid = m->hostid;
+        event.text.assign(m->file);
+        return true;
+    }
+    case ICECC_MSG_API_COMPAT(M_JOB_LOCAL_DONE, Msg::JOB_LOCAL_DONE): {
+        auto *m = dynamic_cast<JobLocalDoneMsg*>(msg);
+        event.type = MonitorEvent::LOCAL_JOB_DONE;
+        event.job_id = m->job_id;
+        return true;
+    }
+    case ICECC_MSG_API_COMPAT(M_MON_JOB_BEGIN, Msg::MON_JOB_BEGIN): {
+        auto *m = dynamic_cast<MonJobBeginMsg*>(msg);
+        event.type = MonitorEvent::JOB_BEGIN;
+        event.job_id = m->job_id;
+        event.hostid = m->hostid;
+        return true;
+    }
+    case ICECC_MSG_API_COMPAT(M_MON_JOB_DONE, Msg::MON_JOB_DONE): {
+        auto *m = dynamic_cast<MonJobDoneMsg*>(msg);
+        event.type = MonitorEvent::JOB_DONE;
+        event.job_id = m->job_id;
+        return true;
+    }
+    case ICECC_MSG_API_COMPAT(M_MON_GET_CS, Msg::MON_GET_CS): {
+        auto *m = dynamic_cast<MonGetCSMsg*>(msg);
+        event.type = MonitorEvent::GET_CS;
+        event.job_id = m->job_id;
+        event.clientid = m->clientid;
+        event.text.assign(m->filename);
+        return true;
+    }
+    case ICECC_MSG_API_COMPAT(M_MON_STATS, Msg::MON_STATS): {
+        auto *m = dynamic_cast<MonStatsMsg*>(msg);
+        event.type = MonitorEvent::STATS;
+        event.hostid = m->hostid;
+        event.text.assign(m->statmsg);
+        return true;
+    }
+    case ICECC_MSG_API_COMPAT(M_END, Msg::END):
+        event.type = MonitorEvent::END;
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Ingest counters that persist across reconnects. Written by the ingest
+// thread, read by the main loop
+struct IngestCounters {
+    std::atomic<uint64_t> events{0};
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<uint64_t> stalls{0};
+    std::atomic<uint64_t> blocked_us{0};
+    std::atomic<size_t> max_depth{0};
+};
+
+// Both ends of a pipe, closed when it goes away
+class Pipe {
+public:
+    Pipe()
+    {
+        if (pipe(fds) < 0)
+            throw std::runtime_error("Unable to create ingest pipe");
+    }
+
+    ~Pipe()
+    {
+        close(fds[0]);
+        close(fds[1]);
+    }
+
+    Pipe(Pipe const &) = delete;
+    Pipe &operator=(Pipe const &) = delete;
+
+    int readEnd() const { return fds[0]; }
+    int writeEnd() const { return fds[1]; }
+
+private:
+    int fds[2];
+};
+
+// Reads and decodes messages from the scheduler connection on its own
+// thread, so that the socket keeps being drained while the main loop is
+// busy rendering. Events are handed to the main loop through a lock-free
+// queue; a pipe wakes up the main loop when the queue becomes non-empty.
+class IngestThread {
+public:
+    IngestThread(MsgChannel *channel, IngestCounters &counters, GUnixFDSourceFunc on_ready, gpointer user_data);
+    ~IngestThread();
+
+    // Main loop side. Returns the next event or nullptr if the queue is
+    // empty. The event must be released with pop() before the next call
+    MonitorEvent *front() { return queue.front(); }
+    void pop() { queue.pop(); }
+
+    // Must be called by the main loop when it is woken up
+    void acknowledge();
+
+    // Requests a wake up for the next event. Until this is called after a
+    // wake up, no further wake ups are sent, so the main loop can take its
+    // time over a backlog. Events pushed before this call don't wake the main
+    // loop, so it must check the queue once more afterwards
+    void rearm();
+
+    void getStats(IngestStats &stats) const;
+
+private:
+    void run();
+    bool enqueue(Msg *msg);
+    void notify();
+
+    MsgChannel *channel;
+    SpscQueue<MonitorEvent> queue;
+    Pipe wake_pipe;
+    Pipe stop_pipe;
+    GlibSource wake_source;
+    std::thread thread;
+    std::atomic<bool> stopping{false};
+    std::atomic<bool> notify_pending{false};
+    IngestCounters &counters;
+};
+
+IngestThread::IngestThread(MsgChannel *c, IngestCounters &counters, GUnixFDSourceFunc on_ready, gpointer user_data) :
+    channel(c), queue(INGEST_QUEUE_SIZE), counters(counters)
+{
+    for (int fd : { wake_pipe.readEnd(), wake_pipe.writeEnd(), stop_pipe.readEnd() })
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    wake_source.set(g_unix_fd_add(wake_pipe.readEnd(), G_IO_IN, on_ready, user_data));
+    thread = std::thread(&IngestThread::run, this);
+}
+
+IngestThread::~IngestThread()
+{
+    stopping = true;
+    if (write(stop_pipe.writeEnd(), "x", 1) < 0) {
+        // The thread will still notice the flag on its next wake up
+    }
+    thread.join();
+
+    wake_source.remove();
+
+    // Anything the main loop did not get to is lost
+    while (queue.front()) {
+        queue.pop();
+        counters.dropped++;
+    }
+}
+
+void IngestThread::acknowledge()
+{
+    char buf[64];
+    while (read(wake_pipe.readEnd(), buf, sizeof(buf)) > 0)
+        ;
+}
+
+void IngestThread::rearm()
+{
+    notify_pending.store(false, std::memory_order_seq_cst);
+}
+
+void IngestThread::notify()
+{
+    if (!notify_pending.exchange(true, std::memory_order_seq_cst)) {
+        if (write(wake_pipe.writeEnd(), "x", 1) < 0) {
+            // Pipe is full, so the main loop is already going to wake up
+        }
+    }
+}
+
+bool IngestThread::enqueue(Msg *msg)
+{
+    MonitorEvent *event = queue.prepare();
+
+    if (!event) {
+        // The main loop is behind. Wait for room rather than dropping the
+        // event, which would corrupt the model
+        gint64 start = g_get_monotonic_time();
+        counters.stalls++;
+        notify();
+        while (!(event = queue.prepare())) {
+            if (stopping)
+                return false;
+            usleep(100);
+        }
+        counters.blocked_us += g_get_monotonic_time() - start;
+    }
+
+    if (!decode_message(msg, *event))
+        return true;
+
+    queue.push();
+    counters.events++;
+
+    size_t depth = queue.size();
+    if (depth > counters.max_depth.load(std::memory_order_relaxed))
+        counters.max_depth = depth;
+
+    notify();
+    return event->type != MonitorEvent::END;
+}
+
+void IngestThread::run()
+{
+    struct pollfd pfd[2];
+    pfd[0].fd = channel->fd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = stop_pipe.readEnd();
+    pfd[1].events = POLLIN;
+
+    bool running = true;
+
+    while (running && !stopping) {
+        if (poll(pfd, 2, -1) < 0)
+            continue;
+
+        if (pfd[1].revents)
+            break;
+
+        while (running && (!channel->read_a_bit() || channel->has_msg())) {
+            std::unique_ptr<Msg> msg(channel->get_msg());
+            if (!msg)
+                break;
+            running = enqueue(msg.get());
+        }
+
+        if (running && channel->at_eof()) {
+            // Let the main loop know the connection is gone
+            MonitorEvent *event;
+            while (!(event = queue.prepare()) && !stopping)
+                usleep(100);
+            if (event) {
+                event->type = MonitorEvent::END;
+                queue.push();
+                notify();
+            }
+            running = false;
+        }
+    }
+}
+
+void IngestThread::getStats(IngestStats &stats) const
+{
+    stats.queue_depth = queue.size();
+    stats.queue_capacity = queue.capacity();
+}
+
+// Gives the hosts and jobs of one of several networks ids that are unique
+// across all of them, so that the networks can share the model
+class IdRemap {
+public:
+    // Translates the ids in event to model ids, allocating ids for hosts and
+    // jobs that are new
+    void map(MonitorEvent &event);
+
+    // Forgets the ids of hosts and jobs that the original, unmapped, event
+    // removed from the model
+    void release(MonitorEvent const &event);
+
+    // Removes the network's hosts and jobs from the model
+    void removeAll();
+
+private:
+    uint32_t mapHost(uint32_t id);
+    uint32_t mapJob(uint32_t id);
+
+    FlatIdMap<uint32_t> hosts;
+    FlatIdMap<uint32_t> jobs;
+
+    static uint32_t next_host_id;
+    static uint32_t next_job_id;
+};
+
+uint32_t IdRemap::next_host_id = 1;
+uint32_t IdRemap::next_job_id = 1;
+
+uint32_t IdRemap::mapHost(uint32_t id)
+{
+    if (!id)
+        return 0;
+
+    auto mapped = hosts.find(id);
+    if (mapped)
+        return *mapped;
+
+    uint32_t host_id = next_host_id++;
+    hosts.set(id, host_id);
+    return host_id;
+}
+
+uint32_t IdRemap::mapJob(uint32_t id)
+{
+    if (!id)
+        return 0;
+
+    auto mapped = jobs.find(id);
+    if (mapped)
+        return *mapped;
+
+    // Job ids can wrap around on a long running monitor
+    uint32_t job_id;
+    do {
+        job_id = next_job_id++;
+    } while (!job_id || Job::find(job_id));
+
+    jobs.set(id, job_id);
+    return job_id;
+}
+
+void IdRemap::map(MonitorEvent &event)
+{
+    event.job_id = mapJob(event.job_id);
+    event.hostid = mapHost(event.hostid);
+    event.clientid = mapHost(event.clientid);
+}
+
+void IdRemap::release(MonitorEvent const &event)
+{
+    switch (event.type) {
+    case MonitorEvent::LOCAL_JOB_DONE:
+    case MonitorEvent::JOB_DONE:
+        jobs.erase(event.job_id);
+        break;
+
+    case MonitorEvent::STATS: {
+        auto mapped = hosts.find(event.hostid);
+        if (mapped && !Host::find(*mapped))
+            hosts.erase(event.hostid);
+        break;
+    }
+
+    default:
+        break;
+    }
+}
+
+void IdRemap::removeAll()
+{
+    jobs.forEach([](uint32_t, uint32_t id) { Job::remove(id); });
+    hosts.forEach([](uint32_t, uint32_t id) { Host::remove(id); });
+    jobs.clear();
+    hosts.clear();
+}
+
 class IcecreamScheduler: public Scheduler {
 public:
-    IcecreamScheduler(std::string const &netname, std::string const &schedname) : Scheduler()
+    // network is the index of the scheduler when there are several. Their
+    // ids are then remapped
+    IcecreamScheduler(std::string const &netname, std::string const &schedname, bool use_ingest_thread,
+            BatchLimits const &limits, std::unique_ptr<EventRecorder> recorder, size_t network = 0,
+            bool remap_ids = false) :
+        Scheduler(), use_ingest_thread(use_ingest_thread), limits(limits), recorder(std::move(recorder)),
+        network(network), requested_net_name(netname), requested_scheduler_name(schedname)
     {
+        if (remap_ids)
+            remap = std::make_unique<IdRemap>();
+
         reconnect(netname, schedname);
     }
 
-    virtual ~IcecreamScheduler() {}
+    virtual ~IcecreamScheduler()
+    {
+        ingest.reset();
+    }
 
     virtual std::string getNetName() const override { return current_net_name; }
     virtual std::string getSchedulerName() const override { return current_scheduler_name; }
+    virtual bool isConnected() const override { return scheduler != nullptr; }
+    virtual gint64 getConnectLatency() const override { return connect_latency; }
+
+    virtual IngestStats getIngestStats() const override
+    {
+        IngestStats stats;
+
+        stats.applied = applied_events;
+        if (!use_ingest_thread)
+            return stats;
+
+        stats.threaded = true;
+        stats.queue_capacity = INGEST_QUEUE_SIZE;
+        stats.queue_max_depth = ingest_counters.max_depth;
+        stats.events = ingest_counters.events;
+        stats.dropped = ingest_counters.dropped;
+        stats.stalls = ingest_counters.stalls;
+        stats.blocked_us = ingest_counters.blocked_us;
+        if (ingest)
+            ingest->getStats(stats);
+        return stats;
+    }
 
 private:
     static gboolean scheduler_process(gint fd, GIOCondition condition, gpointer);
+    static gboolean ingest_process(gint fd, GIOCondition condition, gpointer);
     static gboolean on_reconnect_timer(gpointer);
-
+    static gboolean on_discover_fd(gint fd, GIOCondition condition, gpointer);
+    static gboolean on_discover_timer(gpointer);
+    static gboolean on_backlog(gpointer);
+
+    bool drain();
+    bool drain_channel();
+    bool drain_ingest();
+    void start_backlog();
     bool process_message(MsgChannel *sched);
-    void discover_scheduler(std::string const &netname, std::string const &schedname);
+    bool process_event(MonitorEvent const &event);
+    void poll_discovery();
+    void watch_discovery();
+    void connected(MsgChannel *channel);
+    void discovery_failed();
     void reconnect(std::string const &netname, std::string const &schedname);
 
     std::unique_ptr<MsgChannel> scheduler = nullptr;
+    std::unique_ptr<IngestThread> ingest;
+    bool use_ingest_thread;
+    BatchLimits limits;
+    IngestCounters ingest_counters;
+    uint64_t applied_events = 0;
+    std::unique_ptr<EventRecorder> recorder;
+    size_t network;
+    std::unique_ptr<IdRemap> remap;
+    MonitorEvent event;
+    MonitorEvent mapped_event;
     GlibSource scheduler_source;
+    // Set while events are left over from a batch that ran out of budget
+    GlibSource backlog_source;
+    std::string requested_net_name;
+    std::string requested_scheduler_name;
     std::string current_net_name;
     std::string current_scheduler_name;
     GlibSource reconnect_source;
+
+    // Discovery in progress, if any. The fd sources are re-registered on
+    // every step because DiscoverSched may swap sockets as it moves from
+    // broadcasting to connecting
+    std::unique_ptr<DiscoverSched> discover;
+    GlibSource discover_listen_source;
+    GlibSource discover_connect_source;
+    GlibSource discover_timer_source;
+    gint64 discover_start = 0;
+    gint64 connect_latency = 0;
 };
 
 gboolean IcecreamScheduler::scheduler_process(gint, GIOCondition, gpointer user_data)
 {
     auto *self = static_cast<IcecreamScheduler*>(user_data);
 
-    while (!self->scheduler->read_a_bit() || self->scheduler->has_msg()) {
-        if (!self->process_message(self->scheduler.get()))
-            break;
-    }
+    if (self->drain())
+        self->start_backlog();
 
-    if (self->scheduler->at_eof())
-        self->reconnect(self->current_net_name, self->current_scheduler_name);
+    return TRUE;
+}
+
+gboolean IcecreamScheduler::ingest_process(gint, GIOCondition, gpointer user_data)
+{
+    auto *self = static_cast<IcecreamScheduler*>(user_data);
+
+    self->ingest->acknowledge();
+
+    // A wake up can still arrive after the queue was rearmed part way
+    // through a batch. The backlog source will get to it
+    if (self->backlog_source.get())
+        return TRUE;
+
+    if (self->drain())
+        self->start_backlog();
 
     return TRUE;
 }
 
-void IcecreamScheduler::discover_scheduler(std::string const &netname, std::string const &schedname)
+gboolean IcecreamScheduler::on_backlog(gpointer user_data)
+{
+    auto *self = static_cast<IcecreamScheduler*>(user_data);
+
+    if (self->drain())
+        return TRUE;
+
+    self->backlog_source.clear();
+
+    if (self->scheduler && !self->use_ingest_thread && !self->scheduler_source.get())
+        self->scheduler_source.set(g_unix_fd_add(self->scheduler->fd, G_IO_IN, scheduler_process, self));
+
+    return FALSE;
+}
+
+// Works off the leftover events from an idle source, one batch per main loop
+// iteration, so that input and redraws get their turn in between
+void IcecreamScheduler::start_backlog()
 {
+    // A readable socket would otherwise be dispatched ahead of the redraw on
+    // every iteration. The ingest thread doesn't send wake ups until it is
+    // rearmed
+    scheduler_source.remove();
+
+    if (!backlog_source.get())
+        backlog_source.set(g_idle_add(on_backlog, this));
+}
+
+// Applies one batch of events. Returns true if there are events left over
+bool IcecreamScheduler::drain()
+{
+    if (ingest)
+        return drain_ingest();
+
     if (scheduler)
-        return;
+        return drain_channel();
+
+    return false;
+}
+
+bool IcecreamScheduler::drain_channel()
+{
+    EventBatch batch(limits);
+
+    while (!scheduler->read_a_bit() || scheduler->has_msg()) {
+        if (!batch.next())
+            return true;
 
-    auto discover = std::make_unique<DiscoverSched>(netname, 2, schedname);
+        if (!process_message(scheduler.get()))
+            break;
+    }
+
+    if (scheduler && scheduler->at_eof())
+        reconnect(current_net_name, current_scheduler_name);
+
+    return false;
+}
+
+bool IcecreamScheduler::drain_ingest()
+{
+    EventBatch batch(limits);
+    bool rearmed = false;
 
-    scheduler.reset(discover->try_get_scheduler());
+    for (;;) {
+        auto *event = ingest->front();
 
-    Host::hosts.clear();
-    Job::clearAll();
-    current_scheduler_name.clear();
-    current_net_name.clear();
+        if (!event) {
+            if (rearmed)
+                return false;
+
+            ingest->rearm();
+            rearmed = true;
+            continue;
+        }
 
-    while (!scheduler && !discover->timed_out()) {
-        if (discover->listen_fd() < 0) {
-            usleep(500);
-            scheduler.reset(discover->try_get_scheduler());
-        } else {
-            struct pollfd pfd;
-            pfd.fd = discover->listen_fd();
-            pfd.events = POLLIN;
+        if (!batch.next())
+            return true;
 
-            poll(&pfd, 1, 500);
+        bool more = process_event(*event);
+        ingest->pop();
 
-            scheduler.reset(discover->try_get_scheduler());
+        if (!more) {
+            // The wake up source is removed by reconnecting
+            reconnect(current_net_name, current_scheduler_name);
+            return false;
         }
     }
-    std::cout << "Done waiting" << std::endl;
+}
+
+gboolean IcecreamScheduler::on_discover_fd(gint, GIOCondition, gpointer user_data)
+{
+    auto *self = static_cast<IcecreamScheduler*>(user_data);
+
+    self->poll_discovery();
 
-    if (!scheduler) {
-        std::cout << "Cannot get scheduler" << std::endl;
+    // poll_discovery() always replaces or removes the fd sources
+    return TRUE;
+}
+
+gboolean IcecreamScheduler::on_discover_timer(gpointer user_data)
+{
+    auto *self = static_cast<IcecreamScheduler*>(user_data);
+
+    self->poll_discovery();
+
+    return TRUE;
+}
+
+// Advances discovery by one step without blocking
+void IcecreamScheduler::poll_discovery()
+{
+    if (!discover)
+        return;
+
+    MsgChannel *channel = discover->try_get_scheduler();
+    if (channel) {
+        connected(channel);
         return;
     }
 
-    current_scheduler_name = discover->schedulerName();
-    current_net_name = discover->networkName();
-    if (current_net_name.empty())
-        current_net_name = "ICECREAM";
+    if (discover->timed_out()) {
+        discovery_failed();
+        return;
+    }
+
+    watch_discovery();
+}
+
+void IcecreamScheduler::watch_discovery()
+{
+    discover_listen_source.remove();
+    discover_connect_source.remove();
 
-    std::cout << "Got scheduler " << current_scheduler_name << std::endl;
-    scheduler->setBulkTransfer();
+    // Wake up as soon as a scheduler answers the broadcast, or the connection
+    // to it completes. The timer covers resending broadcasts and timing out
+    if (discover->listen_fd() >= 0)
+        discover_listen_source.set(g_unix_fd_add(discover->listen_fd(), G_IO_IN, on_discover_fd, this));
+
+    if (discover->connect_fd() >= 0)
+        discover_connect_source.set(g_unix_fd_add(discover->connect_fd(), G_IO_OUT, on_discover_fd, this));
+}
+
+void IcecreamScheduler::connected(MsgChannel *channel)
+{
+    std::unique_ptr<MsgChannel> sched(channel);
 
-    if (!scheduler->send_msg(MonLoginMsg())) {
-        std::cout << "Cannot login" << std::endl;
-        scheduler.reset();
+    discover_listen_source.remove();
+    discover_connect_source.remove();
+    discover_timer_source.remove();
+
+    std::string schedname = discover->schedulerName();
+    std::string netname = discover->networkName();
+    discover.reset();
+
+    sched->setBulkTransfer();
+
+    if (!sched->send_msg(MonLoginMsg())) {
+        discovery_failed();
+        return;
+    }
+
+    // The old state is kept on screen until now, so that a reconnect doesn't
+    // blank the display
+    if (remap) {
+        remap->removeAll();
+    } else {
+        Host::clearAll();
+        Job::clearAll();
+    }
+    model_changes.setReset();
+
+    // Tells a replay to start over too
+    if (recorder) {
+        MonitorEvent start;
+        start.type = MonitorEvent::END;
+        start.time = g_get_monotonic_time();
+        recorder->record(start);
+    }
+
+    scheduler = std::move(sched);
+    current_scheduler_name = schedname;
+    current_net_name = netname.empty() ? "ICECREAM" : netname;
+    connect_latency = g_get_monotonic_time() - discover_start;
+
+    if (use_ingest_thread) {
+        try {
+            ingest = std::make_unique<IngestThread>(scheduler.get(), ingest_counters, ingest_process, this);
+        } catch (std::exception const &) {
+            // Without the resources for a thread, messages are read on the
+            // main loop instead
+            ingest.reset();
+        }
     }
+
+    if (!ingest)
+        scheduler_source.set(g_unix_fd_add(scheduler->fd, G_IO_IN, scheduler_process, this));
+
+    if (interface)
+        interface->triggerRedraw();
+}
+
+void IcecreamScheduler::discovery_failed()
+{
+    discover_listen_source.remove();
+    discover_connect_source.remove();
+    discover_timer_source.remove();
+    discover.reset();
+
+    reconnect_source.set(g_timeout_add(5000, on_reconnect_timer, this));
+
+    if (interface)
+        interface->triggerRedraw();
 }
 
 bool IcecreamScheduler::process_message(MsgChannel *sched)
@@ -131,62 +751,42 @@ bool IcecreamScheduler::process_message(MsgChannel *sched)
     if (!msg)
         return false;
 
-    switch (ICECC_MSG_API_COMPAT(msg->type, *msg)) {
-    case ICECC_MSG_API_COMPAT(M_MON_LOCAL_JOB_BEGIN, Msg::MON_LOCAL_JOB_BEGIN): {
-        auto *m = dynamic_cast<MonLocalJobBeginMsg*>(msg.get());
-        Job::createLocal(m->job_id, m->hostid, m->file);
-        break;
-    }
-    case ICECC_MSG_API_COMPAT(M_JOB_LOCAL_DONE, Msg::JOB_LOCAL_DONE): {
-        auto *m = dynamic_cast<JobLocalDoneMsg*>(msg.get());
-        Job::remove(m->job_id);
-        break;
-    }
-    case ICECC_MSG_API_COMPAT(M_MON_JOB_BEGIN, Msg::MON_JOB_BEGIN): {
-        auto *m = dynamic_cast<MonJobBeginMsg*>(msg.get());
-        Job::createRemote(m->job_id, m->hostid);
-        break;
-    }
-    case ICECC_MSG_API_COMPAT(M_MON_JOB_DONE, Msg::MON_JOB_DONE): {
-        auto *m = dynamic_cast<MonJobDoneMsg*>(msg.get());
-        Job::remove(m->job_id);
-        break;
-    }
-    case ICECC_MSG_API_COMPAT(M_MON_GET_CS, Msg::MON_GET_CS): {
-        auto *m = dynamic_cast<MonGetCSMsg*>(msg.get());
-        Job::createPending(m->job_id, m->clientid, m->filename);
-        break;
-    }
-    case ICECC_MSG_API_COMPAT(M_MON_STATS, Msg::MON_STATS): {
-        auto *m = dynamic_cast<MonStatsMsg*>(msg.get());
-        auto host = Host::create(m->hostid);
+    if (!decode_message(msg.get(), event))
+        return true;
 
-        std::stringstream ss(m->statmsg);
-        std::string key;
-        std::string value;
-        bool alive = false;
+    if (!process_event(event)) {
+        reconnect(current_net_name, current_scheduler_name);
+        return false;
+    }
 
-        while (std::getline(ss, key, ':') && std::getline(ss, value)) {
-            if (key == "Name")
-                alive = true;
+    return true;
+}
 
-            host->attr[key] = value;
-        }
+// Returns false if the scheduler connection should be dropped
+bool IcecreamScheduler::process_event(MonitorEvent const &event)
+{
+    if (event.type == MonitorEvent::END)
+        return false;
 
-        if (!alive)
-            Host::remove(m->hostid);
+    if (recorder)
+        recorder->record(event);
 
-        if (interface)
-            interface->triggerRedraw();
-        break;
+    if (remap) {
+        mapped_event = event;
+        remap->map(mapped_event);
+        apply_monitor_event(mapped_event);
+        remap->release(event);
+    } else {
+        apply_monitor_event(event);
     }
-    case ICECC_MSG_API_COMPAT(M_END, Msg::END):
-        reconnect(current_net_name, current_scheduler_name);
-        break;
-    default:
-        break;
+
+    if (network && event.type == MonitorEvent::STATS) {
+        auto host = Host::find(remap ? mapped_event.hostid : event.hostid);
+        if (host)
+            host->setNetwork(network);
     }
 
+    applied_events++;
     return true;
 }
 
@@ -194,37 +794,124 @@ gboolean IcecreamScheduler::on_reconnect_timer(gpointer user_data)
 {
     auto *self = static_cast<IcecreamScheduler*>(user_data);
 
-    self->reconnect(self->current_net_name, self->current_scheduler_name);
+    // Previous attempts failed, so go back to what the user asked for
+    // instead of the last scheduler seen
+    self->reconnect(self->requested_net_name, self->requested_scheduler_name);
 
     return TRUE;
 }
 
+// Starts discovery of the scheduler. This returns immediately; discovery
+// continues from the main loop
 void IcecreamScheduler::reconnect(std::string const &netname, std::string const &schedname)
 {
+    // The ingest thread uses the connection, so it must be stopped first
+    ingest.reset();
     scheduler.reset();
     scheduler_source.remove();
+    backlog_source.remove();
+    reconnect_source.remove();
+
+    discover = std::make_unique<DiscoverSched>(netname, 2, schedname);
+    discover_start = g_get_monotonic_time();
+    discover_timer_source.set(g_timeout_add(DISCOVER_POLL_MS, on_discover_timer, this));
+
+    poll_discovery();
 
     if (interface)
-        interface->suspend();
+        interface->triggerRedraw();
+}
 
-    discover_scheduler(netname, schedname);
 
-    if (scheduler) {
-        scheduler_source.set(g_unix_fd_add(scheduler->fd, G_IO_IN, scheduler_process, this));
-        reconnect_source.remove();
-    } else {
-        reconnect_source.set(g_timeout_add(5000, on_reconnect_timer, this));
+// Monitors several networks, each with its own scheduler connection, as one
+class MultiScheduler: public Scheduler {
+public:
+    explicit MultiScheduler(std::vector<std::unique_ptr<Scheduler> > n) : Scheduler(), networks(std::move(n)) {}
+    virtual ~MultiScheduler() {}
+
+    virtual std::string getNetName() const override
+    {
+        return join(&Scheduler::getNetName);
     }
 
-    if (interface) {
-        interface->resume();
-        interface->triggerRedraw();
+    virtual std::string getSchedulerName() const override
+    {
+        return join(&Scheduler::getSchedulerName);
     }
-}
 
+    virtual bool isConnected() const override
+    {
+        for (auto const &n : networks) {
+            if (!n->isConnected())
+                return false;
+        }
+        return true;
+    }
+
+    virtual gint64 getConnectLatency() const override
+    {
+        gint64 latency = 0;
+        for (auto const &n : networks)
+            latency = std::max(latency, n->getConnectLatency());
+        return latency;
+    }
 
-std::unique_ptr<Scheduler> connect_to_scheduler(std::string const &netname, std::string const &schedname)
+    virtual IngestStats getIngestStats() const override
+    {
+        IngestStats total;
+
+        for (auto const &n : networks) {
+            auto stats = n->getIngestStats();
+
+            total.threaded |= stats.threaded;
+            total.queue_depth += stats.queue_depth;
+            total.queue_max_depth = std::max(total.queue_max_depth, stats.queue_max_depth);
+            total.queue_capacity += stats.queue_capacity;
+            total.events += stats.events;
+            total.dropped += stats.dropped;
+            total.stalls += stats.stalls;
+            total.blocked_us += stats.blocked_us;
+            total.applied += stats.applied;
+        }
+        return total;
+    }
+
+    virtual size_t getNetworkCount() const override { return networks.size(); }
+    virtual Scheduler const &getNetwork(size_t i) const override { return *networks.at(i); }
+
+private:
+    std::string join(std::string (Scheduler::*get)() const) const
+    {
+        std::string result;
+        for (auto const &n : networks) {
+            if (!result.empty())
+                result += ",";
+            result += ((*n).*get)();
+        }
+        return result;
+    }
+
+    std::vector<std::unique_ptr<Scheduler> > networks;
+};
+
+std::unique_ptr<Scheduler> connect_to_scheduler(std::string const &netname, std::string const &schedname,
+        bool use_ingest_thread, BatchLimits const &limits, std::unique_ptr<EventRecorder> recorder)
 {
-    return std::make_unique<IcecreamScheduler>(netname, schedname);
+    return std::make_unique<IcecreamScheduler>(netname, schedname, use_ingest_thread, limits, std::move(recorder));
+}
+
+std::unique_ptr<Scheduler> connect_to_schedulers(std::vector<std::pair<std::string, std::string> > const &networks,
+        bool use_ingest_thread, BatchLimits const &limits)
+{
+    if (networks.size() == 1)
+        return connect_to_scheduler(networks[0].first, networks[0].second, use_ingest_thread, limits);
+
+    std::vector<std::unique_ptr<Scheduler> > schedulers;
+    for (size_t i = 0; i < networks.size(); i++) {
+        schedulers.push_back(std::make_unique<IcecreamScheduler>(networks[i].first, networks[i].second,
+                    use_ingest_thread, limits, nullptr, i, true));
+    }
+
+    return std::make_unique<MultiScheduler>(std::move(schedulers));
 }
 
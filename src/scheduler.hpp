@@ -20,8 +20,25 @@
 #pragma once
 
 #include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "event.hpp"
+#include "record.hpp"
 
 class Scheduler;
 
-std::unique_ptr<Scheduler> connect_to_scheduler(std::string const &netname, std::string const &schedname);
+// If use_ingest_thread is set, the scheduler connection is read and decoded
+// on a dedicated thread instead of the main loop. Events are applied to the
+// model in batches bounded by limits. If a recorder is given, every event
+// applied is recorded
+std::unique_ptr<Scheduler> connect_to_scheduler(std::string const &netname, std::string const &schedname,
+        bool use_ingest_thread = false, BatchLimits const &limits = BatchLimits(),
+        std::unique_ptr<EventRecorder> recorder = nullptr);
 
+// Monitors several networks at once, given as (netname, schedname) pairs.
+// Each network has its own scheduler connection, and its hosts and jobs are
+// renumbered so that they can share the model
+std::unique_ptr<Scheduler> connect_to_schedulers(std::vector<std::pair<std::string, std::string> > const &networks,
+        bool use_ingest_thread = false, BatchLimits const &limits = BatchLimits());
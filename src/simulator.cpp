@@ -17,31 +17,56 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+#include <algorithm>
+#include <cstdlib>
+#include <iomanip>
 #include <random>
+#include <sstream>
+#include <vector>
 #include <glib.h>
 
+#include "containers.hpp"
+#include "placement.hpp"
 #include "simulator.hpp"
 #include "main.hpp"
 
-#define MAX_HOSTS (10)
-#define MAX_JOBS (100)
-#define MAX_HOST_JOBS (20)
-
-class Simulator: public Scheduler {
+class Simulator: public Scheduler, public PlacementFarm {
 public:
-    Simulator(std::uint_fast32_t seed, int cycles, int speed);
+    Simulator(SimulatorConfig const &config, BatchLimits const &limits);
     virtual ~Simulator() {}
 
     virtual std::string getNetName() const override { return "ICECREAM"; }
     virtual std::string getSchedulerName() const override { return "simulator"; }
 
+    virtual IdSet const &getFreeHosts() const override { return free_hosts; }
+
+    virtual size_t getCurrentJobs(uint32_t id) const override
+    {
+        return Host::find(id)->getCurrentJobs().size();
+    }
+
+    virtual size_t getMaxJobs(uint32_t id) const override
+    {
+        return Host::find(id)->getMaxJobs();
+    }
+
+    virtual double getSpeed(uint32_t id) const override
+    {
+        return Host::find(id)->getSpeed();
+    }
+
 private:
     static gboolean process_simulator(gpointer user_data);
+    static gboolean process_fast(gpointer user_data);
 
-    void doCycle();
+    // Returns false once the last cycle has run
+    bool doCycle();
 
     void addHost();
+    void addHost(int max_jobs, double speed, bool no_remote);
     void removeHost();
+    void hostUp();
+    void hostDown();
     void chooseSourceHost();
     std::shared_ptr<Host> getSourceHost();
 
@@ -49,13 +74,19 @@ private:
     void activateJob();
     void addLocalJob();
     void removeJob();
+    void endJob(uint32_t id);
 
-    template<typename T>
-    std::shared_ptr<T> chooseRandom(std::map<uint32_t, std::shared_ptr<T> > const &);
+    // Returns a random member of set other than exclude, or 0 if there is
+    // none
+    uint32_t chooseRandom(IdSet const &set, uint32_t exclude = 0);
 
-    Host::Map getAvailableHosts(uint32_t exclude = 0) const;
+    // Adds or removes the host from free_hosts
+    void updateFree(uint32_t hostid);
 
+    SimulatorConfig config;
+    BatchLimits limits;
     std::minstd_rand random_generator;
+    std::unique_ptr<PlacementPolicy> placement;
     GlibSource timer_source;
     uint32_t next_host_id = 1;
     uint32_t next_job_id = 1;
@@ -67,15 +98,48 @@ private:
         void (Simulator::*action)();
     };
 
-    static const Action actionTable[];
+    std::vector<Action> actions;
+
+    // The simulator is the only thing changing the model, so it keeps its
+    // own indexes of it to pick from at random in constant time
+    IdSet host_ids;
+    // Hosts that can take another remote job
+    IdSet free_hosts;
+    IdSet pending_ids;
+    IdSet local_ids;
+    IdSet remote_ids;
+};
+
+struct Profile {
+    char const *name;
+    SimulatorWeights weights;
+};
+
+// pending, local, activate, remove, source, host_up, host_down
+static const Profile profiles[] = {
+    // A steady trickle of jobs from a few developers
+    { "steady",  {  5,  1,  5,  5,  1, 0, 0 } },
+    // Full rebuilds: bursts of jobs from one host at a time that fill up
+    // the farm
+    { "rebuild", { 20,  1, 10,  4,  1, 0, 0 } },
+    // Mostly jobs that can't be distributed, like links
+    { "link",    {  2, 10,  2,  6,  1, 0, 0 } },
+    // Hosts coming and going while jobs are running
+    { "churn",   {  5,  1,  5,  5,  1, 2, 2 } },
+};
+
+static unsigned SimulatorWeights::* const weight_fields[] = {
+    &SimulatorWeights::pending,
+    &SimulatorWeights::local,
+    &SimulatorWeights::activate,
+    &SimulatorWeights::remove,
+    &SimulatorWeights::source,
+    &SimulatorWeights::host_up,
+    &SimulatorWeights::host_down,
 };
 
-const Simulator::Action Simulator::actionTable[] = {
-    {   5, &Simulator::addPendingJob },
-    {   1, &Simulator::addLocalJob },
-    {   5, &Simulator::activateJob },
-    {   5, &Simulator::removeJob },
-    {   1, &Simulator::chooseSourceHost },
+static char const * const weight_names[] = {
+    "pending", "local", "activate", "remove", "source", "host_up", "host_down",
 };
 
 gboolean Simulator::process_simulator(gpointer user_data)
@@ -85,30 +149,95 @@ gboolean Simulator::process_simulator(gpointer user_data)
     return TRUE;
 }
 
-Simulator::Simulator(std::uint_fast32_t seed, int cycles, int speed):
-    Scheduler(), random_generator(seed), remaining_cycles(cycles)
+gboolean Simulator::process_fast(gpointer user_data)
 {
-    for (int i = 0; i < MAX_HOSTS; i++)
-        addHost();
+    auto *self = static_cast<Simulator*>(user_data);
+    EventBatch batch(self->limits);
 
-    timer_source.set(g_timeout_add(speed, process_simulator, this));
+    while (batch.next()) {
+        if (!self->doCycle()) {
+            self->timer_source.clear();
+            return FALSE;
+        }
+    }
+    return TRUE;
 }
 
-template<typename T>
-std::shared_ptr<T> Simulator::chooseRandom(std::map<uint32_t, std::shared_ptr<T> > const &map)
+Simulator::Simulator(SimulatorConfig const &c, BatchLimits const &l):
+    Scheduler(), config(c), limits(l), random_generator(c.seed), remaining_cycles(c.cycles)
 {
-    std::vector<std::shared_ptr<T> > items;
-    for (auto const &m : map)
-        items.push_back(m.second);
+    void (Simulator::* const action_funcs[])() = {
+        &Simulator::addPendingJob,
+        &Simulator::addLocalJob,
+        &Simulator::activateJob,
+        &Simulator::removeJob,
+        &Simulator::chooseSourceHost,
+        &Simulator::hostUp,
+        &Simulator::hostDown,
+    };
+
+    for (size_t i = 0; i < G_N_ELEMENTS(action_funcs); i++)
+        actions.push_back({ config.weights.*weight_fields[i], action_funcs[i] });
 
-    if (!items.size())
-        return nullptr;
+    placement = create_placement_policy(config.placement, random_generator);
+    if (!placement)
+        placement = create_placement_policy("random", random_generator);
+
+    if (config.farm.groups.empty()) {
+        for (int i = 0; i < config.hosts; i++)
+            addHost();
+    } else {
+        for (auto const &g : config.farm.groups) {
+            for (int i = 0; i < g.count; i++)
+                addHost(g.slots, g.speed, false);
+        }
+    }
+
+    if (config.fast)
+        timer_source.set(g_idle_add(process_fast, this));
+    else
+        timer_source.set(g_timeout_add(config.speed, process_simulator, this));
+}
+
+uint32_t Simulator::chooseRandom(IdSet const &set, uint32_t exclude)
+{
+    size_t excluded = set.indexOf(exclude);
+    size_t count = set.size() - (excluded < set.size() ? 1 : 0);
+
+    if (!count)
+        return 0;
+
+    // Pick from the others by skipping over the excluded one
+    std::uniform_int_distribution<size_t> dis(0, count - 1);
+    size_t n = dis(random_generator);
+    if (n >= excluded)
+        n++;
+
+    return set[n];
+}
+
+void Simulator::updateFree(uint32_t hostid)
+{
+    auto host = Host::find(hostid);
 
-    std::uniform_int_distribution<> dis(0, items.size() - 1);
-    return items[dis(random_generator)];
+    if (host && !host->getNoRemote() && host->getCurrentJobs().size() < host->getMaxJobs())
+        free_hosts.insert(hostid);
+    else
+        free_hosts.erase(hostid);
 }
 
 void Simulator::addHost()
+{
+    // Poor man's normal distribution
+    int span = config.max_host_jobs - config.min_host_jobs;
+    int a = (span + 1) / 2 + 1;
+    int b = span + 2 - a;
+    int max_jobs = random_generator() % a + random_generator() % b + config.min_host_jobs;
+
+    addHost(max_jobs, 100, (rand() % 10) == 0);
+}
+
+void Simulator::addHost(int max_jobs, double speed, bool no_remote)
 {
     auto h = Host::create(next_host_id++);
     {
@@ -116,30 +245,59 @@ void Simulator::addHost()
         ss << "Host " << h->id;
         h->attr["Name"] = ss.str();
     }
+    {
+        std::ostringstream ss;
+        ss << std::fixed << std::setprecision(3) << speed;
+        h->attr["Speed"] = ss.str();
+    }
 
-    // Poor man's normal distribution
-    h->attr["MaxJobs"] = std::to_string(
-            random_generator() % (MAX_HOST_JOBS / 2) + random_generator() % (MAX_HOST_JOBS / 2 - 1) + 1
-            );
-    h->attr["NoRemote"] = ((rand() % 10) == 0 ? "true" : "false");
+    h->attr["MaxJobs"] = std::to_string(max_jobs);
+    h->attr["NoRemote"] = no_remote ? "true" : "false";
     h->attr["Platform"] = "x86_64";
-    h->attr["Speed"] = "100.000";
+    h->updateProfile();
+
+    host_ids.insert(h->id);
+    updateFree(h->id);
 }
 
 void Simulator::removeHost()
 {
-    auto host = chooseRandom(Host::hosts);
-    if (host)
-        Host::remove(host->id);
+    auto host = Host::find(chooseRandom(host_ids));
+    if (!host)
+        return;
+
+    // The scheduler ends the jobs of a host that goes away, then the host
+    std::vector<uint32_t> ids;
+    for (auto const *list : { &host->getPendingJobs(), &host->getActiveJobs() }) {
+        for (auto *j : *list)
+            ids.push_back(j->id);
+    }
+    for (auto *j : host->getCurrentJobs())
+        ids.push_back(j->id);
+
+    for (auto id : ids)
+        endJob(id);
+
+    host_ids.erase(host->id);
+    free_hosts.erase(host->id);
+    Host::remove(host->id);
+}
+
+void Simulator::hostUp()
+{
+    if (host_ids.size() < static_cast<size_t>(std::max(config.hosts * 2, 1)))
+        addHost();
+}
+
+void Simulator::hostDown()
+{
+    if (host_ids.size() > 1)
+        removeHost();
 }
 
 void Simulator::chooseSourceHost()
 {
-    auto host = chooseRandom(Host::hosts);
-    if (host)
-        source_host = host->id;
-    else
-        source_host = 0;
+    source_host = chooseRandom(host_ids);
 }
 
 std::shared_ptr<Host> Simulator::getSourceHost()
@@ -153,17 +311,17 @@ std::shared_ptr<Host> Simulator::getSourceHost()
     return host;
 }
 
-void Simulator::doCycle()
+bool Simulator::doCycle()
 {
     uint32_t total_weight = 0;
-    for (auto const &a : actionTable)
+    for (auto const &a : actions)
         total_weight += a.weight;
 
     std::uniform_int_distribution<> dis(0, total_weight);
 
     uint32_t r = dis(random_generator);
 
-    for (auto const &a : actionTable) {
+    for (auto const &a : actions) {
         if (r < a.weight) {
             (this->*a.action)();
             break;
@@ -171,33 +329,40 @@ void Simulator::doCycle()
         r -= a.weight;
     }
 
-    if (remaining_cycles == 0)
+    if (remaining_cycles == 0) {
         g_main_loop_quit(main_loop);
-    else if (remaining_cycles > 0)
+        return false;
+    } else if (remaining_cycles > 0) {
         remaining_cycles--;
+    }
+    return true;
 }
 
 void Simulator::addPendingJob()
 {
     // Don't add a pending job if there are no free executors
-    auto avail = getAvailableHosts();
     auto host = getSourceHost();
-    if (host && avail.size()) {
+    if (host && !free_hosts.empty()) {
         uint32_t id = next_job_id++;
         std::ostringstream ss;
         ss << "Job_" << id << ".c";
 
         Job::createPending(id, host->id, ss.str());
+        pending_ids.insert(id);
     }
 }
 
 void Simulator::activateJob()
 {
-    if (Job::pendingJobs.size()) {
-        auto const job = chooseRandom(Job::pendingJobs);
-        auto host = chooseRandom(getAvailableHosts(job->clientid));
-        if (host)
-            Job::createRemote(job->id, host->id);
+    if (!pending_ids.empty()) {
+        auto const job = Job::find(chooseRandom(pending_ids));
+        uint32_t hostid = placement->choose(*this, job->clientid);
+        if (hostid) {
+            Job::createRemote(job->id, hostid);
+            pending_ids.erase(job->id);
+            remote_ids.insert(job->id);
+            updateFree(hostid);
+        }
     }
 }
 
@@ -210,33 +375,85 @@ void Simulator::addLocalJob()
         ss << "Job_" << id << ".c";
 
         Job::createLocal(id, host->id, ss.str());
+        local_ids.insert(id);
+        updateFree(host->id);
     }
 }
 
 void Simulator::removeJob()
 {
-    auto job = chooseRandom(Job::activeJobs);
-    if (job)
-        Job::remove(job->id);
+    size_t active = local_ids.size() + remote_ids.size();
+    if (active) {
+        std::uniform_int_distribution<size_t> dis(0, active - 1);
+        auto const &set = dis(random_generator) < local_ids.size() ? local_ids : remote_ids;
+        uint32_t id = chooseRandom(set);
+        if (id)
+            endJob(id);
+    }
 
     // Assign a new job if possible
     activateJob();
 }
 
-Host::Map Simulator::getAvailableHosts(uint32_t except) const
+void Simulator::endJob(uint32_t id)
 {
-    Host::Map result;
+    auto job = Job::find(id);
+    if (!job)
+        return;
 
-    for (auto &h : Host::hosts) {
-        if (h.first != except && h.second->getCurrentJobs().size() < h.second->getMaxJobs())
-            result[h.first] = h.second;
+    uint32_t hostid = job->isActive() ? job->hostid : 0;
+
+    pending_ids.erase(id);
+    local_ids.erase(id);
+    remote_ids.erase(id);
+    Job::remove(id);
+
+    if (hostid)
+        updateFree(hostid);
+}
+
+bool set_simulator_profile(SimulatorConfig &config, std::string const &name)
+{
+    for (auto const &p : profiles) {
+        if (name == p.name) {
+            config.weights = p.weights;
+            return true;
+        }
     }
+    return false;
+}
+
+bool set_simulator_weights(SimulatorConfig &config, std::string const &weights)
+{
+    std::istringstream ss(weights);
+    std::string item;
+
+    while (std::getline(ss, item, ',')) {
+        size_t equals = item.find('=');
+        if (equals == std::string::npos)
+            return false;
 
-    return result;
+        std::string name = item.substr(0, equals);
+        std::string value = item.substr(equals + 1);
+        char *end = nullptr;
+        unsigned long weight = strtoul(value.c_str(), &end, 10);
+
+        if (value.empty() || *end || value[0] == '-' || weight > 1000000)
+            return false;
+
+        size_t i = 0;
+        while (i < G_N_ELEMENTS(weight_names) && name != weight_names[i])
+            i++;
+        if (i == G_N_ELEMENTS(weight_names))
+            return false;
+
+        config.weights.*weight_fields[i] = weight;
+    }
+    return true;
 }
 
-std::unique_ptr<Scheduler> create_simulator(std::uint_fast32_t seed, int cycles, int speed)
+std::unique_ptr<Scheduler> create_simulator(SimulatorConfig const &config, BatchLimits const &limits)
 {
-    return std::make_unique<Simulator>(seed, cycles, speed);
+    return std::make_unique<Simulator>(config, limits);
 }
 
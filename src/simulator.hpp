@@ -19,9 +19,63 @@
 
 #pragma once
 
+#include <cstdint>
 #include <memory>
+#include <string>
+
+#include "event.hpp"
+#include "placement.hpp"
 
 class Scheduler;
 
-std::unique_ptr<Scheduler> create_simulator(std::uint_fast32_t seed = 1234567, int cycles = -1, int speed = 20);
+// Relative chance of each thing the simulator can do in a cycle
+struct SimulatorWeights {
+    // Submit a job from the source host for a compile server
+    unsigned pending = 5;
+    // Start a job on the source host itself
+    unsigned local = 1;
+    // Assign a pending job to a compile server
+    unsigned activate = 5;
+    // Finish a job, then assign a pending one
+    unsigned remove = 5;
+    // Switch which host is submitting jobs
+    unsigned source = 1;
+    // Add a host
+    unsigned host_up = 0;
+    // Remove a host and its jobs
+    unsigned host_down = 0;
+};
+
+struct SimulatorConfig {
+    std::uint_fast32_t seed = 1234567;
+    // -1 for no limit
+    int cycles = -1;
+    // Milliseconds between cycles
+    int speed = 20;
+    // Run cycles back to back instead, as many per main loop iteration as
+    // the batch limits allow
+    bool fast = false;
+    // Number of hosts at the start
+    int hosts = 10;
+    // Range of the maximum jobs of each host. Values near the middle are
+    // the most likely
+    int min_host_jobs = 1;
+    int max_host_jobs = 18;
+    // If it has groups, the farm is made of these hosts instead
+    FarmSpec farm;
+    // See create_placement_policy()
+    std::string placement = "random";
+    SimulatorWeights weights;
+};
+
+// Sets the weights of a named workload profile: "steady", "rebuild",
+// "link" or "churn". Returns false if the name is unknown
+bool set_simulator_profile(SimulatorConfig &config, std::string const &name);
+
+// Overrides weights from a comma separated list of name=weight, e.g.
+// "pending=10,host_down=1". Returns false if the list is invalid
+bool set_simulator_weights(SimulatorConfig &config, std::string const &weights);
+
+std::unique_ptr<Scheduler> create_simulator(SimulatorConfig const &config,
+        BatchLimits const &limits = BatchLimits());
 
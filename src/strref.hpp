@@ -0,0 +1,117 @@
+/*
+ * Command line Icecream status monitor
+ * Copyright (C) 2018-2020 by Garmin Ltd. or its subsidiaries.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+// A non-owning reference to a range of characters. Used to pick apart
+// strings in place without allocating
+class StringRef {
+public:
+    static constexpr size_t npos = std::string::npos;
+
+    StringRef() : m_data(""), m_size(0) {}
+    StringRef(char const *data, size_t size) : m_data(data), m_size(size) {}
+    StringRef(char const *str) : m_data(str), m_size(strlen(str)) {}
+    StringRef(std::string const &str) : m_data(str.data()), m_size(str.size()) {}
+
+    char const *data() const { return m_data; }
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    char const *begin() const { return m_data; }
+    char const *end() const { return m_data + m_size; }
+
+    char operator[](size_t i) const { return m_data[i]; }
+
+    std::string str() const
+    {
+        return std::string(m_data, m_size);
+    }
+
+    size_t find(char c, size_t pos = 0) const
+    {
+        if (pos >= m_size)
+            return npos;
+
+        auto const *p = static_cast<char const*>(memchr(m_data + pos, c, m_size - pos));
+        return p ? p - m_data : npos;
+    }
+
+    size_t rfind(char c) const
+    {
+        for (size_t i = m_size; i > 0; i--) {
+            if (m_data[i - 1] == c)
+                return i - 1;
+        }
+        return npos;
+    }
+
+    StringRef substr(size_t pos, size_t len = npos) const
+    {
+        pos = std::min(pos, m_size);
+        return StringRef(m_data + pos, std::min(len, m_size - pos));
+    }
+
+    // Returns everything up to the first instance of sep and removes it
+    // (and the separator) from this reference
+    StringRef split(char sep)
+    {
+        size_t pos = find(sep);
+        StringRef head = substr(0, pos);
+
+        if (pos == npos) {
+            m_data += m_size;
+            m_size = 0;
+        } else {
+            m_data += pos + 1;
+            m_size -= pos + 1;
+        }
+        return head;
+    }
+
+    int compare(StringRef const &other) const
+    {
+        size_t n = std::min(m_size, other.m_size);
+        int r = n ? memcmp(m_data, other.m_data, n) : 0;
+        if (r)
+            return r;
+        if (m_size == other.m_size)
+            return 0;
+        return m_size < other.m_size ? -1 : 1;
+    }
+
+private:
+    char const *m_data;
+    size_t m_size;
+};
+
+inline bool operator==(StringRef const &a, StringRef const &b)
+{
+    return a.size() == b.size() && (a.empty() || memcmp(a.data(), b.data(), a.size()) == 0);
+}
+
+inline bool operator!=(StringRef const &a, StringRef const &b) { return !(a == b); }
+inline bool operator<(StringRef const &a, StringRef const &b) { return a.compare(b) < 0; }
+
+// std::string converts implicitly, so the operators above also allow
+// heterogeneous lookup in std::less<> keyed containers of std::string
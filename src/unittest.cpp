@@ -0,0 +1,524 @@
+/*
+ * Command line Icecream status monitor
+ * Copyright (C) 2018-2020 by Garmin Ltd. or its subsidiaries.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+// Unit tests of the containers behind the model, the path store and the
+// what-if simulation. Failed checks are printed, and the exit status is
+// non-zero if there were any
+
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "containers.hpp"
+#include "pathstore.hpp"
+#include "whatif.hpp"
+
+static int failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #cond << std::endl; \
+            failures++; \
+        } \
+    } while (0)
+
+// Returns count keys that all hash to the last bucket of a FlatIdMap of
+// capacity 16, so their probe chain wraps around to the start of the array
+static std::vector<uint32_t> colliding_keys(size_t count)
+{
+    std::vector<uint32_t> keys;
+
+    for (uint32_t key = 1; keys.size() < count; key++) {
+        if ((static_cast<uint32_t>(key * UINT32_C(2654435761)) >> 28) == 15)
+            keys.push_back(key);
+    }
+    return keys;
+}
+
+static void test_flat_id_map()
+{
+    {
+        FlatIdMap<int> map;
+        CHECK(map.empty());
+        CHECK(!map.find(1));
+
+        map.set(1, 10);
+        map.set(1, 11);
+        CHECK(map.size() == 1);
+        CHECK(map.find(1) && *map.find(1) == 11);
+        CHECK(!map.erase(2));
+        CHECK(map.erase(1));
+        CHECK(!map.find(1));
+        CHECK(map.empty());
+    }
+
+    {
+        // Erasing from the middle of a chain that wraps around has to pull
+        // the later entries back without losing them
+        auto keys = colliding_keys(4);
+        FlatIdMap<uint32_t> map;
+        for (auto k : keys)
+            map.set(k, k * 2);
+
+        CHECK(map.erase(keys[1]));
+        CHECK(!map.find(keys[1]));
+        for (auto k : { keys[0], keys[2], keys[3] })
+            CHECK(map.find(k) && *map.find(k) == k * 2);
+
+        CHECK(map.erase(keys[0]));
+        for (auto k : { keys[2], keys[3] })
+            CHECK(map.find(k) && *map.find(k) == k * 2);
+
+        map.set(keys[1], 1);
+        CHECK(map.size() == 3);
+        CHECK(map.find(keys[1]) && *map.find(keys[1]) == 1);
+    }
+
+    {
+        // Random operations, including rehashes, against a std::map
+        std::minstd_rand random(1234);
+        std::uniform_int_distribution<uint32_t> key(1, 2000);
+        FlatIdMap<uint32_t> map;
+        std::map<uint32_t, uint32_t> expected;
+
+        for (uint32_t i = 0; i < 100000; i++) {
+            uint32_t k = key(random);
+            if (random() % 3) {
+                map.set(k, i);
+                expected[k] = i;
+            } else {
+                CHECK(map.erase(k) == (expected.erase(k) != 0));
+            }
+        }
+
+        CHECK(map.size() == expected.size());
+        for (uint32_t k = 1; k <= 2000; k++) {
+            auto i = expected.find(k);
+            auto v = map.find(k);
+            CHECK((i == expected.end()) == !v);
+            if (v && i != expected.end())
+                CHECK(*v == i->second);
+        }
+
+        size_t seen = 0;
+        map.forEach([&](uint32_t k, uint32_t v) {
+            CHECK(expected.count(k) && expected[k] == v);
+            seen++;
+        });
+        CHECK(seen == expected.size());
+
+        map.clear();
+        CHECK(map.empty());
+        CHECK(!map.find(expected.begin()->first));
+    }
+
+    {
+        // After a burst, the map shrinks back once it is cleared with few
+        // entries in it
+        FlatIdMap<bool> map;
+        for (uint32_t id = 1; id <= 100000; id++)
+            map.set(id, true);
+        size_t burst_capacity = map.capacity();
+
+        map.clear();
+        CHECK(map.capacity() == burst_capacity);
+
+        for (uint32_t id = 1; id <= 10; id++)
+            map.set(id * 7919, true);
+        map.clear();
+        CHECK(map.capacity() <= 64);
+        CHECK(map.empty());
+
+        for (uint32_t id = 1; id <= 100; id++)
+            map.set(id, true);
+        CHECK(map.size() == 100);
+        CHECK(map.find(100) && !map.find(101));
+    }
+}
+
+struct Item: public ListHook<Item> {
+    explicit Item(int v) : value(v) {}
+    int value;
+};
+
+static void test_intrusive_list()
+{
+    Item a(1), b(2), c(3);
+    IntrusiveList<Item> first;
+    IntrusiveList<Item> second;
+
+    first.push_back(&a);
+    first.push_back(&b);
+    first.push_back(&c);
+    CHECK(first.size() == 3);
+    CHECK(first.front() == &a);
+
+    first.erase(&b);
+    CHECK(first.size() == 2);
+    CHECK(!first.contains(&b));
+
+    std::vector<int> values;
+    for (auto *i : first)
+        values.push_back(i->value);
+    CHECK((values == std::vector<int>{ 1, 3 }));
+
+    // Pushing onto another list moves the item
+    second.push_back(&a);
+    CHECK(first.size() == 1 && first.front() == &c);
+    CHECK(second.contains(&a));
+
+    IntrusiveList<Item>::unlink(&a);
+    IntrusiveList<Item>::unlink(&b);
+    CHECK(second.empty());
+
+    first.clear();
+    CHECK(first.empty());
+}
+
+static void test_object_pool()
+{
+    ObjectPool<Item, 4> pool;
+    std::vector<Item*> items;
+
+    for (int i = 0; i < 10; i++)
+        items.push_back(pool.create(i));
+    CHECK(pool.size() == 10);
+    CHECK(pool.capacity() == 12);
+    for (int i = 0; i < 10; i++)
+        CHECK(items[i]->value == i);
+
+    // Freed slots are reused before the pool grows
+    Item *freed = items[3];
+    pool.destroy(freed);
+    items[3] = pool.create(30);
+    CHECK(items[3] == freed);
+    CHECK(items[3]->value == 30);
+    CHECK(pool.capacity() == 12);
+
+    for (auto *i : items)
+        pool.destroy(i);
+    CHECK(pool.size() == 0);
+}
+
+static void test_ring_buffer()
+{
+    // A zero capacity buffer, as with --history 0, ignores pushes
+    RingBuffer<int> none;
+    none.push(1);
+    CHECK(none.empty());
+    CHECK(none.size() == 0);
+    CHECK(none.total() == 0);
+
+    RingBuffer<int> ring(3);
+    for (int i = 1; i <= 2; i++)
+        ring.push(i);
+    CHECK(ring.size() == 2 && !ring.full());
+    CHECK(ring[0] == 1 && ring.back() == 2);
+
+    // Wrapping around overwrites the oldest entries
+    for (int i = 3; i <= 7; i++)
+        ring.push(i);
+    CHECK(ring.full());
+    CHECK(ring.total() == 7);
+    CHECK(ring[0] == 5 && ring[1] == 6 && ring[2] == 7);
+    CHECK(ring.back() == 7);
+
+    ring.clear();
+    CHECK(ring.empty());
+    ring.push(8);
+    CHECK(ring.size() == 1 && ring[0] == 8 && ring.back() == 8);
+
+    ring.setCapacity(2);
+    CHECK(ring.empty() && ring.capacity() == 2);
+}
+
+static void test_rollup_series()
+{
+    RollupSeries<uint16_t> series({ { 1, 4 }, { 2, 3 }, { 3, 2 } });
+    CHECK(series.levels() == 3);
+
+    for (uint16_t v = 1; v <= 6; v++)
+        series.push(v);
+
+    // Each level averages the samples of the one before it, rounding to
+    // the nearest
+    auto const &first = series.getLevel(0);
+    CHECK(first.size() == 4 && first[0] == 3 && first.back() == 6);
+
+    auto const &second = series.getLevel(1);
+    CHECK(second.size() == 3);
+    CHECK(second[0] == 2 && second[1] == 4 && second[2] == 6);
+
+    auto const &third = series.getLevel(2);
+    CHECK(third.size() == 1 && third[0] == 4);
+
+    series.push(7);
+    series.push(8);
+    CHECK(second.size() == 3 && second[0] == 4 && second.back() == 8);
+    CHECK(third.size() == 1);
+
+    // Clearing also drops the partial averages
+    series.push(9);
+    series.clear();
+    CHECK(first.empty() && second.empty() && third.empty());
+    series.push(10);
+    series.push(20);
+    CHECK(second.size() == 1 && second[0] == 15);
+
+    // The sums don't overflow the sample type
+    RollupSeries<uint16_t> full({ { 1, 1 }, { 4, 1 } });
+    for (int i = 0; i < 4; i++)
+        full.push(UINT16_MAX);
+    CHECK(full.getLevel(1).size() == 1 && full.getLevel(1)[0] == UINT16_MAX);
+}
+
+static void test_log_histogram()
+{
+    typedef LogHistogram<3, 36> Histogram;
+    Histogram h;
+    CHECK(h.empty() && h.percentile(0.5) == 0);
+
+    // Values below 2^SubBits, and those of the first range above it, each
+    // have their own bucket
+    for (uint64_t v = 0; v < 16; v++)
+        h.add(v);
+    CHECK(h.count() == 16);
+    CHECK(h.percentile(0) == 0);
+    CHECK(h.percentile(0.5) == 7);
+    CHECK(h.percentile(1) == 15);
+
+    // From 16 on the buckets get wider, 2 at first and 64 around 1000. They
+    // report their middle, rounded down
+    h.clear();
+    CHECK(h.empty());
+    h.add(16);
+    h.add(17);
+    CHECK(h.percentile(1) == 16);
+    h.add(18);
+    CHECK(h.percentile(1) == 18);
+    h.add(1000);
+    CHECK(h.percentile(1) == 960 + 31);
+
+    // Nearest rank
+    h.clear();
+    for (int i = 0; i < 90; i++)
+        h.add(1);
+    for (int i = 0; i < 9; i++)
+        h.add(5);
+    h.add(7);
+    CHECK(h.percentile(0.5) == 1);
+    CHECK(h.percentile(0.9) == 1);
+    CHECK(h.percentile(0.95) == 5);
+    CHECK(h.percentile(0.99) == 5);
+    CHECK(h.percentile(1) == 7);
+
+    // Larger values are accurate to within 1/2^SubBits
+    for (uint64_t v : { UINT64_C(100), UINT64_C(1000), UINT64_C(123456), UINT64_C(987654321) }) {
+        Histogram one;
+        one.add(v);
+        uint64_t p = one.percentile(0.5);
+        CHECK((p > v ? p - v : v - p) <= v / 8);
+    }
+
+    // Values of 2^MaxBits or more go into the last bucket, with the largest
+    // values below it
+    Histogram clamped;
+    clamped.add(UINT64_MAX);
+    clamped.add(UINT64_C(1) << 36);
+    clamped.add((UINT64_C(1) << 36) - 1);
+    CHECK(clamped.percentile(0) == clamped.percentile(1));
+    CHECK(clamped.percentile(1) >= UINT64_C(15) << 32);
+    CHECK(clamped.percentile(1) < UINT64_C(1) << 36);
+}
+
+static void test_slot_table()
+{
+    Item a(1), b(2);
+    SlotTable<Item> table;
+
+    for (size_t i = 0; i < 3; i++)
+        CHECK(table.claim(&a) == i);
+    CHECK(table.size() == 3 && table.used() == 3);
+
+    table.release(1);
+    CHECK(!table.get(1) && table.get(0) == &a);
+    CHECK(!table.get(10));
+    CHECK(table.used() == 2);
+
+    // The lowest free slot is reused before a new one is added
+    CHECK(table.claim(&b) == 1);
+    CHECK(table.get(1) == &b);
+    CHECK(table.size() == 3);
+
+    // Past 64 slots the free bitmap takes more than one word
+    for (size_t i = 3; i < 130; i++)
+        CHECK(table.claim(&a) == i);
+    table.release(100);
+    table.release(70);
+    table.release(5);
+    CHECK(table.used() == 127);
+    CHECK(table.claim(&b) == 5);
+    CHECK(table.claim(&b) == 70);
+    CHECK(table.claim(&b) == 100);
+    CHECK(table.claim(&b) == 130);
+    CHECK(table.used() == 131 && table.get(130) == &b);
+
+    table.clear();
+    CHECK(table.size() == 0 && table.used() == 0);
+    CHECK(table.claim(&a) == 0);
+}
+
+static void test_id_set()
+{
+    IdSet set;
+    CHECK(set.empty());
+
+    CHECK(set.insert(5));
+    CHECK(set.insert(7));
+    CHECK(set.insert(9));
+    CHECK(!set.insert(7));
+    CHECK(set.size() == 3);
+    CHECK(set[2] == 9 && set.indexOf(9) == 2);
+    CHECK(set.indexOf(4) == set.size());
+
+    // Erasing moves the last member into the hole
+    CHECK(set.erase(5));
+    CHECK(!set.erase(5));
+    CHECK(set.size() == 2 && set[0] == 9 && set[1] == 7);
+    CHECK(set.indexOf(9) == 0 && set.indexOf(7) == 1);
+
+    CHECK(set.erase(7));
+    CHECK(set.size() == 1 && set.contains(9) && !set.contains(7));
+
+    // Random operations against a std::set. The indexes have to stay in step
+    // with the members
+    std::minstd_rand random(4321);
+    std::uniform_int_distribution<uint32_t> id(1, 500);
+    std::set<uint32_t> expected = { 9 };
+
+    for (int i = 0; i < 20000; i++) {
+        uint32_t k = id(random);
+        if (random() % 2)
+            CHECK(set.insert(k) == expected.insert(k).second);
+        else
+            CHECK(set.erase(k) == (expected.erase(k) != 0));
+    }
+
+    CHECK(set.size() == expected.size());
+    for (size_t i = 0; i < set.size(); i++) {
+        CHECK(expected.count(set[i]));
+        CHECK(set.indexOf(set[i]) == i);
+    }
+
+    set.clear();
+    CHECK(set.empty() && !set.contains(*expected.begin()));
+}
+
+static void test_path_store()
+{
+    PathStore store;
+
+    CHECK(store.intern("") == PathStore::EMPTY);
+    CHECK(store.str(PathStore::EMPTY).empty());
+
+    // Paths round trip exactly, including empty components
+    for (char const *path : { "a", "src/main.cpp", "/usr/include/stdio.h", "a//b/", "/" }) {
+        auto h = store.intern(path);
+        CHECK(store.str(h) == path);
+        CHECK(store.intern(path) == h);
+    }
+
+    auto a = store.intern("src/a.c");
+    auto b = store.intern("src/b.c");
+    CHECK(a != b);
+    CHECK(store.intern("other/a.c") != a);
+
+    // Shared directories are only stored once
+    size_t size = store.size();
+    store.intern("src/c.c");
+    CHECK(store.size() == size + 1);
+
+    // append() adds to what is already there
+    std::string out = "file: ";
+    store.append(b, out);
+    CHECK(out == "file: src/b.c");
+
+    std::string deep;
+    for (int i = 0; i < 1000; i++)
+        deep += "d" + std::to_string(i) + "/";
+    deep += "file.c";
+    CHECK(store.str(store.intern(deep)) == deep);
+}
+
+static void test_what_if()
+{
+    // A single host has no other host to send its jobs to, so it has to
+    // compile them itself
+    WhatIfConfig config;
+    CHECK(parse_farm_spec("1x8", config.farm));
+    config.duration = 600;
+    config.seed = 123456;
+
+    std::ostringstream out;
+    CHECK(run_what_if(config, out));
+
+    // A summary and a header, then a row for each policy
+    std::istringstream rows(out.str());
+    std::string row;
+    std::getline(rows, row);
+    std::getline(rows, row);
+
+    size_t policies = 0;
+    while (std::getline(rows, row)) {
+        std::istringstream fields(row);
+        std::string policy;
+        uint64_t completed = 0;
+
+        fields >> policy >> completed;
+        CHECK(completed > 0);
+        policies++;
+    }
+    CHECK(policies == get_placement_policy_names().size());
+}
+
+int main()
+{
+    test_flat_id_map();
+    test_intrusive_list();
+    test_object_pool();
+    test_ring_buffer();
+    test_rollup_series();
+    test_log_histogram();
+    test_slot_table();
+    test_id_set();
+    test_path_store();
+    test_what_if();
+
+    if (failures) {
+        std::cerr << failures << " checks failed" << std::endl;
+        return 1;
+    }
+    return 0;
+}
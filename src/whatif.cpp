@@ -0,0 +1,268 @@
+/*
+ * Command line Icecream status monitor
+ * Copyright (C) 2018-2020 by Garmin Ltd. or its subsidiaries.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <queue>
+#include <random>
+
+#include "whatif.hpp"
+
+// Speed of hosts that don't report one
+#define DEFAULT_SPEED (100.0)
+
+class WhatIfFarm: public PlacementFarm {
+public:
+    virtual ~WhatIfFarm() {}
+
+    void addHost(size_t slots, double speed, bool no_remote)
+    {
+        hosts.push_back({ slots, speed > 0 ? speed : DEFAULT_SPEED, no_remote, 0 });
+        updateFree(hosts.size());
+    }
+
+    size_t size() const { return hosts.size(); }
+
+    void startJob(uint32_t id)
+    {
+        host(id).busy++;
+        updateFree(id);
+    }
+
+    void finishJob(uint32_t id)
+    {
+        host(id).busy--;
+        updateFree(id);
+    }
+
+    // Slots that accept remote jobs, and their total speed
+    size_t getRemoteSlots() const
+    {
+        size_t slots = 0;
+        for (auto const &h : hosts)
+            slots += h.no_remote ? 0 : h.slots;
+        return slots;
+    }
+
+    double getRemoteCapacity() const
+    {
+        double capacity = 0;
+        for (auto const &h : hosts)
+            capacity += h.no_remote ? 0 : h.slots * h.speed;
+        return capacity;
+    }
+
+    virtual IdSet const &getFreeHosts() const override { return free; }
+    virtual size_t getCurrentJobs(uint32_t id) const override { return host(id).busy; }
+    virtual size_t getMaxJobs(uint32_t id) const override { return host(id).slots; }
+    virtual double getSpeed(uint32_t id) const override { return host(id).speed; }
+
+private:
+    struct Host {
+        size_t slots;
+        double speed;
+        bool no_remote;
+        size_t busy;
+    };
+
+    // Host ids are their index + 1
+    Host &host(uint32_t id) { return hosts[id - 1]; }
+    Host const &host(uint32_t id) const { return hosts[id - 1]; }
+
+    void updateFree(uint32_t id)
+    {
+        if (!host(id).no_remote && host(id).busy < host(id).slots)
+            free.insert(id);
+        else
+            free.erase(id);
+    }
+
+    std::vector<Host> hosts;
+    IdSet free;
+};
+
+struct WhatIfResult {
+    uint64_t completed = 0;
+    // Slot seconds spent compiling
+    double busy_time = 0;
+    // Seconds each started job waited for a host
+    std::vector<double> waits;
+    // Jobs still waiting at the end
+    size_t queued = 0;
+    // Real seconds the simulation took
+    double run_time = 0;
+};
+
+static WhatIfResult simulate(WhatIfConfig const &config, WhatIfFarm farm, std::string const &policy_name)
+{
+    struct Event {
+        double time;
+        // The host where a job finished, or 0 for a new job
+        uint32_t host;
+
+        bool operator>(Event const &other) const { return time > other.time; }
+    };
+
+    struct Pending {
+        double submitted;
+        uint32_t client;
+        // Seconds at speed 100
+        double work;
+    };
+
+    auto start = std::chrono::steady_clock::now();
+
+    // The workload comes from its own generator, so that every policy gets
+    // exactly the same jobs
+    std::minstd_rand workload(config.seed);
+    std::exponential_distribution<> next_arrival(config.rate);
+    std::exponential_distribution<> job_work(1 / config.job_time);
+    std::uniform_int_distribution<uint32_t> job_client(1, farm.size());
+
+    std::minstd_rand placement_random(config.seed);
+    auto policy = create_placement_policy(policy_name, placement_random);
+
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event> > events;
+    std::deque<Pending> pending;
+    WhatIfResult result;
+    size_t busy = 0;
+    double now = 0;
+
+    events.push({ next_arrival(workload), 0 });
+
+    while (!events.empty() && events.top().time <= config.duration) {
+        Event e = events.top();
+        events.pop();
+
+        result.busy_time += busy * (e.time - now);
+        now = e.time;
+
+        if (e.host) {
+            farm.finishJob(e.host);
+            busy--;
+            result.completed++;
+        } else {
+            uint32_t client = job_client(workload);
+            pending.push_back({ now, client, job_work(workload) });
+            events.push({ now + next_arrival(workload), 0 });
+        }
+
+        // Jobs are assigned in the order they were submitted. If the only
+        // free host is the job's own client, it compiles the job itself, as
+        // with icecream. Otherwise no host is free, and no later job could
+        // be placed either
+        while (!pending.empty()) {
+            auto const &job = pending.front();
+            uint32_t host = policy->choose(farm, job.client);
+            if (!host && farm.getFreeHosts().contains(job.client))
+                host = job.client;
+            if (!host)
+                break;
+
+            farm.startJob(host);
+            busy++;
+            result.waits.push_back(now - job.submitted);
+            events.push({ now + job.work * DEFAULT_SPEED / farm.getSpeed(host), host });
+            pending.pop_front();
+        }
+    }
+
+    result.busy_time += busy * (config.duration - now);
+    result.queued = pending.size();
+    result.run_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+static void write_result(std::ostream &out, WhatIfConfig const &config, std::string const &policy,
+        size_t slots, WhatIfResult &r)
+{
+    double wait_total = 0;
+    for (auto w : r.waits)
+        wait_total += w;
+
+    auto percentile = [&](double p) {
+        if (r.waits.empty())
+            return 0.0;
+        size_t i = std::min(static_cast<size_t>(p * r.waits.size()), r.waits.size() - 1);
+        std::nth_element(r.waits.begin(), r.waits.begin() + i, r.waits.end());
+        return r.waits[i];
+    };
+
+    double wait_avg = r.waits.empty() ? 0 : wait_total / r.waits.size();
+    double p50 = percentile(0.50);
+    double p95 = percentile(0.95);
+    double p99 = percentile(0.99);
+
+    out << std::left << std::setw(10) << policy << std::right <<
+        std::setw(10) << r.completed <<
+        std::setw(9) << std::setprecision(2) << r.completed / config.duration <<
+        std::setw(10) << wait_avg <<
+        std::setw(10) << p50 <<
+        std::setw(10) << p95 <<
+        std::setw(10) << p99 <<
+        std::setw(8) << r.queued <<
+        std::setw(8) << std::setprecision(1) << 100 * r.busy_time / (slots * config.duration) << "%" <<
+        std::setw(9) << std::setprecision(0) << config.duration / std::max(r.run_time, 1e-6) << "x" <<
+        std::endl;
+}
+
+bool run_what_if(WhatIfConfig const &config, std::ostream &out)
+{
+    WhatIfFarm farm;
+
+    for (auto const &g : config.farm.groups) {
+        for (int i = 0; i < g.count; i++)
+            farm.addHost(g.slots, g.speed, g.no_remote);
+    }
+
+    size_t slots = farm.getRemoteSlots();
+    if (!slots) {
+        std::cerr << "The farm has no hosts that accept jobs" << std::endl;
+        return false;
+    }
+
+    auto policies = config.policies.empty() ? get_placement_policy_names() : config.policies;
+    std::minstd_rand unused;
+    for (auto const &p : policies) {
+        if (!create_placement_policy(p, unused)) {
+            std::cerr << "Unknown placement policy " << p << std::endl;
+            return false;
+        }
+    }
+
+    // Fraction of the farm's compile capacity the workload needs
+    double load = config.rate * config.job_time * DEFAULT_SPEED / farm.getRemoteCapacity();
+
+    out << std::fixed <<
+        farm.size() << " hosts with " << slots << " slots for remote jobs. " <<
+        std::setprecision(2) << config.rate << " jobs/s of " << config.job_time << "s each for " <<
+        std::setprecision(0) << config.duration << "s, " << load * 100 << "% of capacity" << std::endl <<
+        "POLICY     COMPLETED   JOBS/S  WAIT AVG  WAIT P50  WAIT P95  WAIT P99  QUEUED    UTIL  SPEEDUP" <<
+        std::endl;
+
+    for (auto const &p : policies) {
+        auto result = simulate(config, farm, p);
+        write_result(out, config, p, slots, result);
+    }
+
+    return true;
+}
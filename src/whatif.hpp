@@ -0,0 +1,50 @@
+/*
+ * Command line Icecream status monitor
+ * Copyright (C) 2018-2020 by Garmin Ltd. or its subsidiaries.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "placement.hpp"
+
+// A what-if run simulates a farm in virtual time, without the main loop, to
+// see how it would cope with a workload. Jobs are submitted at random by all
+// the hosts, at rate jobs per second on average, and take job_time seconds
+// on average on a host with speed 100.
+struct WhatIfConfig {
+    FarmSpec farm;
+    // Policies to compare. All of them if empty
+    std::vector<std::string> policies;
+    // Simulated seconds
+    double duration = 3600;
+    double rate = 20;
+    double job_time = 10;
+    std::uint_fast32_t seed = 1234567;
+};
+
+// Runs the workload on the farm once for each policy, and writes the
+// throughput, queue wait and utilization of each to out. A job that no other
+// host can take is compiled by its client if it has a free slot. Only the
+// groups of the farm are simulated, so the caller has to add the current
+// hosts to them. Returns false if the farm has no hosts that accept jobs or
+// a policy is unknown
+bool run_what_if(WhatIfConfig const &config, std::ostream &out);